@@ -0,0 +1,121 @@
+#include "FragmentCache.h"
+
+namespace hwp {
+
+// 条目的固定开销估计（链表节点、索引节点、键）
+static constexpr size_t EntryOverhead = 128;
+
+static size_t fragmentBytes(const FragmentCache::Fragment &fragment) {
+  size_t bytes = sizeof(fragment);
+  if (fragment.content) {
+    bytes += fragment.content->size();
+  }
+  if (fragment.macros) {
+    for (const auto &macro : *fragment.macros) {
+      bytes += sizeof(macro) + macro.size();
+    }
+  }
+  for (const auto &[name, text] : fragment.structs) {
+    bytes += EntryOverhead + name.size() + (text ? text->size() : 0);
+  }
+  return bytes;
+}
+
+FragmentCache &FragmentCache::instance() {
+  static FragmentCache cache;
+  return cache;
+}
+
+FragmentCache::Entry *FragmentCache::lookup(const Key &key) {
+  auto it = index.find(key);
+  if (it == index.end()) {
+    return nullptr;
+  }
+  lru.splice(lru.begin(), lru, it->second);
+  return &*it->second;
+}
+
+void FragmentCache::store(Entry entry) {
+  auto it = index.find(entry.key);
+  if (it != index.end()) {
+    counters.bytes -= it->second->bytes;
+    lru.erase(it->second);
+    index.erase(it);
+  }
+  counters.bytes += entry.bytes;
+  lru.push_front(std::move(entry));
+  index.emplace(lru.front().key, lru.begin());
+  evict();
+}
+
+void FragmentCache::evict() {
+  // 至少保留刚插入的条目
+  while (counters.bytes > capacity && lru.size() > 1) {
+    Entry &victim = lru.back();
+    counters.bytes -= victim.bytes;
+    index.erase(victim.key);
+    lru.pop_back();
+    ++counters.evictions;
+  }
+}
+
+std::shared_ptr<const FragmentCache::Fragment> FragmentCache::find(uint64_t source, const std::string &file,
+                                                                 unsigned line) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry *entry = lookup({source, file, line, 0});
+  if (!entry) {
+    ++counters.misses;
+    return nullptr;
+  }
+  ++counters.hits;
+  return entry->fragment;
+}
+
+void FragmentCache::insert(uint64_t source, const std::string &file, unsigned line,
+                           std::shared_ptr<const Fragment> fragment) {
+  size_t bytes = EntryOverhead + file.size() + fragmentBytes(*fragment);
+  std::lock_guard<std::mutex> lock(mutex);
+  store({{source, file, line, 0}, std::move(fragment), std::string(), bytes});
+}
+
+std::optional<std::string> FragmentCache::findBrief(uint64_t source, const std::string &file, unsigned line,
+                                                   uint64_t lines_hash) {
+  std::lock_guard<std::mutex> lock(mutex);
+  // 哈希为 0 的键留给 Fragment 条目
+  Entry *entry = lookup({source, file, line, lines_hash | 1});
+  if (!entry) {
+    ++counters.brief_misses;
+    return std::nullopt;
+  }
+  ++counters.brief_hits;
+  return entry->brief;
+}
+
+void FragmentCache::insertBrief(uint64_t source, const std::string &file, unsigned line, uint64_t lines_hash,
+                                std::string brief) {
+  size_t bytes = EntryOverhead + file.size() + brief.size();
+  std::lock_guard<std::mutex> lock(mutex);
+  store({{source, file, line, lines_hash | 1}, nullptr, std::move(brief), bytes});
+}
+
+void FragmentCache::setCapacity(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity = bytes;
+  evict();
+}
+
+FragmentCache::Stats FragmentCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  Stats ret = counters;
+  ret.entries = lru.size();
+  return ret;
+}
+
+void FragmentCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  lru.clear();
+  index.clear();
+  counters.bytes = 0;
+}
+
+} // namespace hwp
@@ -0,0 +1,82 @@
+#pragma once
+#ifndef FRAGMENT_CACHE_H
+#define FRAGMENT_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace hwp {
+
+// 进程级的函数片段缓存：同一个函数（如驱动的 ioctl 分发函数）会出现在大量切片中，
+// 每个切片是独立的 llvm::Module，其源码内容、宏、结构体在不同报告之间可以复用。
+//
+// 与切片无关的部分以 (源码版本, 源文件, DISubprogram 行号) 为键，源码版本即 SourceProvider::version()，
+// 不同 provider 中的同名文件、以及 provider 内容更新前后的同一文件互不混用；
+// function_content_brief 依赖切片的调试行号集合，额外以函数范围内行号集合的哈希为键。
+// 线程安全，按字节数上限做 LRU 淘汰。
+class FragmentCache {
+public:
+  // 各部分按需计算，未计算的为 nullopt
+  struct Fragment {
+    unsigned end_line = 0;
+    std::optional<std::string> content;
+    std::optional<std::vector<std::string>> macros;
+    // 结构体名 -> 定义文本；值为 nullopt 表示该结构体未在函数范围内使用
+    std::map<std::string, std::optional<std::string>> structs;
+  };
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t brief_hits = 0;
+    size_t brief_misses = 0;
+    size_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+  };
+
+  static FragmentCache &instance();
+
+  std::shared_ptr<const Fragment> find(uint64_t source, const std::string &file, unsigned line);
+  void insert(uint64_t source, const std::string &file, unsigned line, std::shared_ptr<const Fragment> fragment);
+
+  std::optional<std::string> findBrief(uint64_t source, const std::string &file, unsigned line, uint64_t lines_hash);
+  void insertBrief(uint64_t source, const std::string &file, unsigned line, uint64_t lines_hash, std::string brief);
+
+  // 缓存总字节数上限（近似值），超出时淘汰最久未使用的条目
+  void setCapacity(size_t bytes);
+  Stats stats();
+  void clear();
+
+private:
+  using Key = std::tuple<uint64_t, std::string, unsigned, uint64_t>;
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<const Fragment> fragment;
+    std::string brief;
+    size_t bytes;
+  };
+
+  std::mutex mutex;
+  size_t capacity = 256u << 20;
+  Stats counters;
+  // 链表头部为最近使用的条目
+  std::list<Entry> lru;
+  std::map<Key, std::list<Entry>::iterator> index;
+
+  Entry *lookup(const Key &key);
+  void store(Entry entry);
+  void evict();
+};
+
+} // namespace hwp
+
+#endif
@@ -0,0 +1,163 @@
+#include "ReportArchive.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hwp {
+
+static bool writeAll(int fd, const char *buf, size_t len, off_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+ReportArchiveWriter::ReportArchiveWriter(const std::string &path) {
+  data_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  index_fd = open((path + ".idx").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (data_fd < 0 || index_fd < 0) {
+    std::cerr << "Failed to open report archive " << path << ": " << std::strerror(errno) << "\n";
+    return;
+  }
+
+  // 续写已有归档
+  struct stat st;
+  if (fstat(data_fd, &st) == 0) {
+    data_end = st.st_size;
+  }
+}
+
+ReportArchiveWriter::~ReportArchiveWriter() {
+  if (data_fd >= 0) {
+    close(data_fd);
+  }
+  if (index_fd >= 0) {
+    close(index_fd);
+  }
+}
+
+bool ReportArchiveWriter::append(const std::string &path_id, const std::string &vulnerability_type,
+                                 const nlohmann::json &report) {
+  return append(path_id, vulnerability_type, std::string_view(report.dump()));
+}
+
+bool ReportArchiveWriter::append(const std::string &path_id, const std::string &vulnerability_type,
+                                 std::string_view data) {
+  if (!is_open()) {
+    return false;
+  }
+  if (path_id.find_first_of("\t\n") != std::string::npos ||
+      vulnerability_type.find_first_of("\t\n") != std::string::npos) {
+    std::cerr << "Invalid archive key: " << path_id << "\n";
+    return false;
+  }
+
+  // 每条报告后跟一个换行，便于直接查看数据文件；索引中的长度不含换行
+  std::string record;
+  record.reserve(data.size() + 1);
+  record.append(data);
+  record += '\n';
+
+  uint64_t offset = data_end.fetch_add(record.size());
+  if (!writeAll(data_fd, record.data(), record.size(), offset)) {
+    std::cerr << "Failed to write report " << path_id << " to archive: " << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  std::string line = std::to_string(offset) + "\t" + std::to_string(data.size()) + "\t" + path_id + "\t" +
+                     vulnerability_type + "\n";
+  std::lock_guard<std::mutex> lock(index_mutex);
+  if (write(index_fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+    std::cerr << "Failed to write archive index for " << path_id << ": " << std::strerror(errno) << "\n";
+    return false;
+  }
+  return true;
+}
+
+ReportArchiveReader::ReportArchiveReader(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Failed to open report archive " << path << ": " << std::strerror(errno) << "\n";
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return;
+  }
+  data_size = st.st_size;
+  if (data_size > 0) {
+    void *p = mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      std::cerr << "Failed to map report archive " << path << ": " << std::strerror(errno) << "\n";
+      close(fd);
+      return;
+    }
+    data = static_cast<const char *>(p);
+  }
+  close(fd);
+  opened = true;
+
+  std::ifstream ifs(path + ".idx");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    size_t t1 = line.find('\t');
+    size_t t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+    size_t t3 = t2 == std::string::npos ? t2 : line.find('\t', t2 + 1);
+    if (t3 == std::string::npos) {
+      continue;
+    }
+    uint64_t offset, length;
+    try {
+      offset = std::stoull(line.substr(0, t1));
+      length = std::stoull(line.substr(t1 + 1, t2 - t1 - 1));
+    } catch (const std::exception &) {
+      continue;
+    }
+    // 索引可能比映射时的数据文件更新，越界的条目忽略
+    if (offset + length > data_size) {
+      continue;
+    }
+    index[{line.substr(t2 + 1, t3 - t2 - 1), line.substr(t3 + 1)}] = {offset, length};
+  }
+}
+
+ReportArchiveReader::~ReportArchiveReader() {
+  if (data) {
+    munmap(const_cast<char *>(data), data_size);
+  }
+}
+
+std::optional<std::string_view> ReportArchiveReader::find(const std::string &path_id,
+                                                          const std::string &vulnerability_type) const {
+  auto it = index.find({path_id, vulnerability_type});
+  if (it == index.end()) {
+    return std::nullopt;
+  }
+  return std::string_view(data + it->second.first, it->second.second);
+}
+
+std::optional<nlohmann::json> ReportArchiveReader::get(const std::string &path_id,
+                                                       const std::string &vulnerability_type) const {
+  auto text = find(path_id, vulnerability_type);
+  if (!text) {
+    return std::nullopt;
+  }
+  return nlohmann::json::parse(text->begin(), text->end());
+}
+
+} // namespace hwp
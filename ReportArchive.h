@@ -0,0 +1,77 @@
+#pragma once
+#ifndef REPORT_ARCHIVE_H
+#define REPORT_ARCHIVE_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace hwp {
+
+// 报告归档：所有报告追加写入同一个数据文件 <path>，
+// 偏移索引写入 <path>.idx，每行 "offset\tlength\tpath_id\tvulnerability_type"。
+// 数据先写入、索引后写入，索引中的条目总是指向完整的报告。
+
+// 多个线程可以并发调用 append：偏移通过原子加法预留，数据用 pwrite 写入，只有索引行的写入需要加锁
+class ReportArchiveWriter {
+public:
+  explicit ReportArchiveWriter(const std::string &path);
+  ~ReportArchiveWriter();
+
+  ReportArchiveWriter(const ReportArchiveWriter &) = delete;
+  ReportArchiveWriter &operator=(const ReportArchiveWriter &) = delete;
+
+  bool is_open() const { return data_fd >= 0 && index_fd >= 0; }
+
+  // path_id 与 vulnerability_type 中不能包含制表符或换行
+  bool append(const std::string &path_id, const std::string &vulnerability_type, const nlohmann::json &report);
+  bool append(const std::string &path_id, const std::string &vulnerability_type, std::string_view data);
+
+private:
+  int data_fd = -1;
+  int index_fd = -1;
+  std::atomic<uint64_t> data_end{0};
+  std::mutex index_mutex;
+};
+
+// 以 mmap 方式读取归档，按 (path_id, vulnerability_type) 取单个报告而不解析其他内容
+class ReportArchiveReader {
+public:
+  explicit ReportArchiveReader(const std::string &path);
+  ~ReportArchiveReader();
+
+  ReportArchiveReader(const ReportArchiveReader &) = delete;
+  ReportArchiveReader &operator=(const ReportArchiveReader &) = delete;
+
+  bool is_open() const { return opened; }
+  size_t size() const { return index.size(); }
+
+  // 返回报告的原始 JSON 文本，指向映射内存，在 reader 析构前有效
+  std::optional<std::string_view> find(const std::string &path_id, const std::string &vulnerability_type) const;
+
+  std::optional<nlohmann::json> get(const std::string &path_id, const std::string &vulnerability_type) const;
+
+  // 按键顺序遍历所有条目
+  template <typename Fn> void forEach(Fn fn) const {
+    for (const auto &[key, extent] : index) {
+      fn(key.first, key.second, std::string_view(data + extent.first, extent.second));
+    }
+  }
+
+private:
+  bool opened = false;
+  const char *data = nullptr;
+  size_t data_size = 0;
+  // (path_id, vulnerability_type) -> (offset, length)，同一键出现多次时以最后一次为准
+  std::map<std::pair<std::string, std::string>, std::pair<uint64_t, uint64_t>> index;
+};
+
+} // namespace hwp
+
+#endif
@@ -0,0 +1,406 @@
+#include "ReportDaemon.h"
+#include "FragmentCache.h"
+#include <llvm/IRReader/IRReader.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace hwp {
+
+static bool sendAll(int fd, const std::string &data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    off += n;
+  }
+  return true;
+}
+
+ReportDaemon::ReportDaemon(Options opts) : opts(std::move(opts)) {
+  if (!this->opts.sources) {
+    this->opts.sources = DiskSourceProvider::shared();
+  }
+  if (this->opts.workers == 0) {
+    this->opts.workers = 1;
+  }
+  if (this->opts.max_pending == 0) {
+    this->opts.max_pending = 1;
+  }
+}
+
+ReportDaemon::~ReportDaemon() {
+  stop();
+  for (auto &t : threads) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+  // worker 均已退出，所有连接（包括处理中被归还的）都在 connections 中
+  for (auto &[fd, conn] : connections) {
+    close(fd);
+  }
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    unlink(opts.socket_path.c_str());
+  }
+  for (int fd : wake_fds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+bool ReportDaemon::start() {
+  sockaddr_un addr{};
+  if (opts.socket_path.empty() || opts.socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Invalid socket path: " << opts.socket_path << "\n";
+    return false;
+  }
+
+  if (pipe2(wake_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+    std::cerr << "pipe2() failed: " << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    std::cerr << "socket() failed: " << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, opts.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(opts.socket_path.c_str());
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(listen_fd, static_cast<int>(opts.max_pending)) < 0) {
+    std::cerr << "Failed to listen on " << opts.socket_path << ": " << std::strerror(errno) << "\n";
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  for (unsigned i = 0; i < opts.workers; ++i) {
+    threads.emplace_back(&ReportDaemon::workerLoop, this);
+  }
+  return true;
+}
+
+void ReportDaemon::wake() {
+  char c = 0;
+  // 管道满时说明 run() 已有待处理的唤醒，忽略 EAGAIN
+  [[maybe_unused]] ssize_t n = write(wake_fds[1], &c, 1);
+}
+
+bool ReportDaemon::dispatch(int fd, Connection &conn) {
+  size_t pos = conn.buffer.find('\n');
+  while (pos == 0) {
+    conn.buffer.erase(0, 1);
+    pos = conn.buffer.find('\n');
+  }
+  if (pos == std::string::npos) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  pending.push_back({fd, conn.buffer.substr(0, pos)});
+  conn.buffer.erase(0, pos + 1);
+  conn.busy = true;
+  queue_not_empty.notify_one();
+  return true;
+}
+
+void ReportDaemon::run() {
+  char chunk[4096];
+  std::vector<pollfd> fds;
+
+  while (!stopping) {
+    // 处理完成的连接重新参与读取
+    std::vector<int> idle;
+    size_t queued;
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      idle.swap(returned);
+      queued = pending.size();
+    }
+    for (int fd : idle) {
+      connections[fd].busy = false;
+    }
+    // 每轮都检查所有空闲连接：缓冲区中已有完整请求的在队列未满时派发，
+    // 队列满时请求留在缓冲区，下一轮（worker 完成后唤醒）再试
+    for (auto &[fd, conn] : connections) {
+      if (queued >= opts.max_pending) {
+        break;
+      }
+      if (!conn.busy && dispatch(fd, conn)) {
+        ++queued;
+      }
+    }
+
+    // 请求队列满时既不读取也不 accept，由 socket 缓冲区与 listen 队列向客户端施加背压
+    const bool accepting = queued < opts.max_pending;
+    fds.clear();
+    fds.push_back({wake_fds[0], POLLIN, 0});
+    if (accepting) {
+      fds.push_back({listen_fd, POLLIN, 0});
+      for (auto &[fd, conn] : connections) {
+        if (!conn.busy) {
+          fds.push_back({fd, POLLIN, 0});
+        }
+      }
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "poll() failed: " << std::strerror(errno) << "\n";
+      break;
+    }
+
+    if (fds[0].revents) {
+      while (read(wake_fds[0], chunk, sizeof(chunk)) > 0) {
+      }
+    }
+    if (!accepting || stopping) {
+      continue;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        connections.emplace(fd, Connection());
+      } else if (errno != EINTR && errno != ECONNABORTED) {
+        std::cerr << "accept() failed: " << std::strerror(errno) << "\n";
+      }
+    }
+
+    for (size_t i = 2; i < fds.size(); ++i) {
+      if (!fds[i].revents) {
+        continue;
+      }
+      int fd = fds[i].fd;
+      Connection &conn = connections[fd];
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      if (n <= 0) {
+        close(fd);
+        connections.erase(fd);
+        continue;
+      }
+      // 只追加到缓冲区，由下一轮开头统一派发，派发前检查队列上限；
+      // 每个连接同时只有一个请求在处理，保证回复顺序与请求顺序一致
+      conn.buffer.append(chunk, n);
+    }
+  }
+}
+
+void ReportDaemon::stop() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (stopping.exchange(true)) {
+      return;
+    }
+  }
+  if (wake_fds[1] >= 0) {
+    wake();
+  }
+  queue_not_empty.notify_all();
+}
+
+void ReportDaemon::workerLoop() {
+  // 每个 worker 持有独立的常驻会话，ReportManager 本身不是线程安全的
+  ReportManager RM(opts.sources);
+
+  while (true) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex);
+      queue_not_empty.wait(lock, [this] { return stopping || !pending.empty(); });
+      if (stopping) {
+        return;
+      }
+      request = std::move(pending.front());
+      pending.pop_front();
+    }
+
+    json reply;
+    try {
+      reply = handleJob(RM, json::parse(request.line));
+    } catch (const std::exception &e) {
+      reply = {{"ok", false}, {"error", e.what()}};
+    }
+    if (!sendAll(request.fd, reply.dump() + "\n")) {
+      // 客户端已断开，连接归还后由 run() 读到 EOF 关闭
+      shutdown(request.fd, SHUT_RD);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      returned.push_back(request.fd);
+    }
+    wake();
+  }
+}
+
+json ReportDaemon::handleJob(ReportManager &RM, const json &job) {
+  if (job.value("cmd", std::string()) == "stats") {
+    FragmentCache::Stats stats = FragmentCache::instance().stats();
+    return {{"ok", true},
+            {"fragment_cache",
+             {{"hits", stats.hits},
+              {"misses", stats.misses},
+              {"brief_hits", stats.brief_hits},
+              {"brief_misses", stats.brief_misses},
+              {"evictions", stats.evictions},
+              {"entries", stats.entries},
+              {"bytes", stats.bytes}}}};
+  }
+
+  if (job.value("cmd", std::string()) == "reset") {
+    // 更新 provider 版本后，各 worker 在下一个报告开始时丢弃按文件缓存的结果，旧版本的片段不会再被命中
+    opts.sources->invalidate();
+    FragmentCache::instance().clear();
+    return {{"ok", true}};
+  }
+
+  std::string ir_path = job.at("ir").get<std::string>();
+
+  llvm::LLVMContext Context;
+  llvm::SMDiagnostic Err;
+  // parseIRFile 同时支持 .ll 与 .bc
+  std::unique_ptr<llvm::Module> M = llvm::parseIRFile(ir_path, Err, Context);
+  if (!M) {
+    return {{"ok", false}, {"error", ir_path + ": " + Err.getMessage().str()}};
+  }
+
+  // trace 以 (函数名, 函数内指令序号) 表示
+  std::vector<const llvm::Instruction *> trace;
+  std::map<std::string, std::vector<const llvm::Instruction *>> instructions;
+  for (const auto &entry : job.value("trace", json::array())) {
+    std::string function_name = entry.at("function").get<std::string>();
+    size_t index = entry.at("index").get<size_t>();
+
+    auto it = instructions.find(function_name);
+    if (it == instructions.end()) {
+      const llvm::Function *F = M->getFunction(function_name);
+      if (!F) {
+        return {{"ok", false}, {"error", "Unknown trace function: " + function_name}};
+      }
+      std::vector<const llvm::Instruction *> insts;
+      for (const auto &B : *F) {
+        for (const auto &I : B) {
+          insts.push_back(&I);
+        }
+      }
+      it = instructions.emplace(function_name, std::move(insts)).first;
+    }
+    if (index >= it->second.size()) {
+      return {{"ok", false}, {"error", "Trace index out of range in " + function_name}};
+    }
+    trace.push_back(it->second[index]);
+  }
+
+  // 提取快照后即释放 module，渲染期间不再占用其内存
+  ReportManager::Params params = paramsFromJson(job.value("params", json::object()));
+  ReportManager::ReportSnapshot snapshot = RM.snapshot(*M, trace, job.value("no_trace", false), params);
+  trace.clear();
+  instructions.clear();
+  M.reset();
+  json report = RM.getJson(snapshot, params);
+
+  std::string archive_path = job.value("archive", std::string());
+  if (!archive_path.empty()) {
+    ReportArchiveWriter *archive = getArchive(archive_path);
+    if (!archive || !archive->append(report.value("path_id", std::string()),
+                                     report.value("vulnerability_type", std::string()), report)) {
+      return {{"ok", false}, {"error", "Failed to append report to archive: " + archive_path}};
+    }
+    return {{"ok", true}, {"archive", archive_path}};
+  }
+
+  std::string output = job.value("output", std::string());
+  if (output.empty()) {
+    return {{"ok", true}, {"report", std::move(report)}};
+  }
+
+  std::ofstream outputFile(output);
+  if (!outputFile.is_open()) {
+    return {{"ok", false}, {"error", "Failed to open output file: " + output}};
+  }
+  outputFile << report.dump(4);
+  return {{"ok", true}, {"output", output}};
+}
+
+ReportArchiveWriter *ReportDaemon::getArchive(const std::string &path) {
+  std::lock_guard<std::mutex> lock(archives_mutex);
+  auto &archive = archives[path];
+  if (!archive) {
+    archive = std::make_unique<ReportArchiveWriter>(path);
+  }
+  if (!archive->is_open()) {
+    archives.erase(path);
+    return nullptr;
+  }
+  return archive.get();
+}
+
+ReportManager::Params ReportDaemon::paramsFromJson(const json &j) {
+  ReportManager::Params p;
+  p.path_id = j.value("path_id", std::string());
+  p.produce_line = j.value("produce_line", std::string());
+  p.sink_info_type = j.value("sink_info_type", std::string());
+  p.sink_info_paramters_obj_name = j.value("sink_info_paramters_obj_name", std::string());
+  p.sink_info_paramters_end_line = j.value("sink_info_paramters_end_line", std::string());
+  p.sink_info_paramters_array_name = j.value("sink_info_paramters_array_name", std::string());
+  p.sink_info_paramters_array_index = j.value("sink_info_paramters_array_index", std::string());
+  p.sink_info_paramters_col = j.value("sink_info_paramters_col", 0u);
+  p.sink_info_line_id = j.value("sink_info_line_id", std::string());
+  p.sink_info_sink_line = j.value("sink_info_sink_line", 0u);
+  p.source_info_type = j.value("source_info_type", std::string());
+  p.source_info_line_id = j.value("source_info_line_id", std::string());
+  p.source_info_source_line = j.value("source_info_source_line", 0u);
+  p.vulnerability_type = j.value("vulnerability_type", std::string());
+  p.compact_trace = j.value("compact_trace", false);
+  p.compact_trace_ir = j.value("compact_trace_ir", false);
+
+  // "fields" 可以是 ReportField 掩码，也可以是报告字段名数组，如 ["function_content_brief", "trace"]
+  if (j.contains("fields")) {
+    const json &fields = j.at("fields");
+    if (fields.is_array()) {
+      static const std::map<std::string, unsigned> names = {
+          {"function_content", ReportManager::FieldFunctionContent},
+          {"function_content_brief", ReportManager::FieldFunctionContentBrief},
+          {"struct", ReportManager::FieldStruct},
+          {"macro", ReportManager::FieldMacro},
+          {"trace", ReportManager::FieldTrace},
+      };
+      p.fields = 0;
+      for (const auto &name : fields) {
+        auto it = names.find(name.get<std::string>());
+        if (it == names.end()) {
+          throw std::invalid_argument("Unknown report field: " + name.get<std::string>());
+        }
+        p.fields |= it->second;
+      }
+    } else {
+      p.fields = fields.get<unsigned>();
+    }
+  }
+  return p;
+}
+
+} // namespace hwp
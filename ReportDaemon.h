@@ -0,0 +1,107 @@
+#pragma once
+#ifndef REPORT_DAEMON_H
+#define REPORT_DAEMON_H
+
+#include "ReportArchive.h"
+#include "ReportManager.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hwp {
+
+// 常驻报告服务：通过 Unix domain socket 接收报告任务，
+// 每个 worker 持有一个常驻的 ReportManager，嵌套结构、宏、结构体等缓存在任务之间保持有效。
+//
+// 协议：每行一个 JSON 请求，每个请求回复一行 JSON。
+//   请求: {"ir": "slice.bc", "trace": [{"function": "f", "index": 3}, ...], "no_trace": false,
+//          "params": {"path_id": "...", ...}, "output": "report.json"}
+//   回复: {"ok": true, "output": "report.json"} 或 {"ok": true, "report": {...}} 或 {"ok": false, "error": "..."}
+//   请求中给出 "archive" 时报告追加到该归档（见 ReportArchive），回复 {"ok": true, "archive": "..."}
+//   {"cmd": "stats"} 返回进程级片段缓存的命中统计
+//   {"cmd": "reset"} 丢弃所有已读取的源码及由其得到的缓存（源码树更新后调用），回复 {"ok": true}
+//
+// 请求逐个派发给空闲的 worker，而不是把连接固定在某个 worker 上，空闲的长连接不占用 worker；
+// 同一连接上的请求依次处理，回复顺序与请求顺序一致。
+class ReportDaemon {
+public:
+  struct Options {
+    std::string socket_path;
+    // 同时处理的请求数（即 worker 数）
+    unsigned workers = 4;
+    // 等待处理的请求上限，队列满时暂停读取与 accept，由 socket 缓冲区与 listen 队列向客户端施加背压
+    unsigned max_pending = 64;
+    // 所有 worker 共用的源码来源，为空时使用 DiskSourceProvider::shared()
+    std::shared_ptr<SourceProvider> sources;
+  };
+
+  explicit ReportDaemon(Options opts);
+  ~ReportDaemon();
+
+  // 创建监听 socket 并启动 worker，失败返回 false
+  bool start();
+
+  // 连接的读取与请求派发循环，直到 stop() 被调用
+  void run();
+
+  // 可在其他线程或信号处理后调用
+  void stop();
+
+  // 由请求中的 "params" 对象构造 Params，缺省字段置空
+  static ReportManager::Params paramsFromJson(const json &j);
+
+private:
+  struct Connection {
+    // 已读取但尚未派发的数据
+    std::string buffer;
+    // 有请求正在排队或处理，期间不读取该连接
+    bool busy = false;
+  };
+
+  struct Request {
+    int fd = -1;
+    std::string line;
+  };
+
+  Options opts;
+  int listen_fd = -1;
+  // worker 完成请求或 stop() 时写入，唤醒阻塞在 poll() 上的 run()
+  int wake_fds[2] = {-1, -1};
+  std::atomic<bool> stopping{false};
+
+  // 仅由 run() 所在线程访问
+  std::map<int, Connection> connections;
+
+  std::mutex queue_mutex;
+  std::condition_variable queue_not_empty;
+  std::deque<Request> pending;
+  // 请求处理完毕、等待 run() 重新读取的连接
+  std::vector<int> returned;
+
+  std::vector<std::thread> threads;
+
+  // 按路径共享的归档写入器，多个 worker 可并发追加
+  std::mutex archives_mutex;
+  std::map<std::string, std::unique_ptr<ReportArchiveWriter>> archives;
+
+  ReportArchiveWriter *getArchive(const std::string &path);
+
+  void workerLoop();
+
+  void wake();
+
+  // 缓冲区中有完整的请求行时将其加入队列并标记连接为 busy，返回是否派发
+  bool dispatch(int fd, Connection &conn);
+
+  json handleJob(ReportManager &RM, const json &job);
+};
+
+} // namespace hwp
+
+#endif
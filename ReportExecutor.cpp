@@ -0,0 +1,121 @@
+#include "ReportExecutor.h"
+#include <iostream>
+
+namespace hwp {
+
+ReportExecutor::ReportExecutor(Options opts) : opts(std::move(opts)) {
+  if (!this->opts.sources) {
+    this->opts.sources = DiskSourceProvider::shared();
+  }
+  if (this->opts.workers == 0) {
+    this->opts.workers = 1;
+  }
+  if (this->opts.max_in_flight == 0) {
+    this->opts.max_in_flight = 1;
+  }
+  for (unsigned i = 0; i < this->opts.workers; ++i) {
+    threads.emplace_back(&ReportExecutor::workerLoop, this);
+  }
+}
+
+ReportExecutor::~ReportExecutor() {
+  drain();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queue_not_empty.notify_all();
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+std::future<json> ReportExecutor::submit(ReportManager::ReportJob job) {
+  auto promise = std::make_shared<std::promise<json>>();
+  std::future<json> result = promise->get_future();
+  submit(std::move(job), [promise](json report) { promise->set_value(std::move(report)); });
+  return result;
+}
+
+void ReportExecutor::submit(ReportManager::ReportJob job, Callback done) {
+  if (!job.snapshot) {
+    job.snapshot = std::make_shared<const ReportManager::ReportSnapshot>(
+        ReportManager::snapshot(*job.module, job.trace, job.no_trace, job.params));
+    job.module = nullptr;
+    job.trace.clear();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  task_done.wait(lock, [this] { return in_flight < opts.max_in_flight; });
+  ++in_flight;
+  pending.push_back({std::move(job), std::move(done)});
+  queue_not_empty.notify_one();
+}
+
+std::future<json> ReportExecutor::submit(const llvm::Module &M, const Trace &report, bool no_trace,
+                                         ReportManager::Params params) {
+  ReportManager::ReportSnapshot snap = ReportManager::snapshot(M, report, no_trace, params);
+  return submit(std::move(snap), std::move(params));
+}
+
+void ReportExecutor::submit(const llvm::Module &M, const Trace &report, bool no_trace, ReportManager::Params params,
+                            Callback done) {
+  ReportManager::ReportSnapshot snap = ReportManager::snapshot(M, report, no_trace, params);
+  submit(std::move(snap), std::move(params), std::move(done));
+}
+
+std::future<json> ReportExecutor::submit(ReportManager::ReportSnapshot snapshot, ReportManager::Params params) {
+  return submit({nullptr, {}, false, std::move(params),
+                 std::make_shared<const ReportManager::ReportSnapshot>(std::move(snapshot))});
+}
+
+void ReportExecutor::submit(ReportManager::ReportSnapshot snapshot, ReportManager::Params params, Callback done) {
+  submit({nullptr, {}, false, std::move(params),
+          std::make_shared<const ReportManager::ReportSnapshot>(std::move(snapshot))},
+         std::move(done));
+}
+
+void ReportExecutor::drain() {
+  std::unique_lock<std::mutex> lock(mutex);
+  task_done.wait(lock, [this] { return in_flight == 0; });
+}
+
+size_t ReportExecutor::inFlight() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return in_flight;
+}
+
+void ReportExecutor::workerLoop() {
+  // 每个 worker 持有独立的 ReportManager，按文件的缓存在任务之间保持有效
+  ReportManager RM(opts.sources);
+
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queue_not_empty.wait(lock, [this] { return stopping || !pending.empty(); });
+      if (pending.empty()) {
+        return;
+      }
+      task = std::move(pending.front());
+      pending.pop_front();
+    }
+
+    json report = RM.runJob(task.job);
+    if (task.done) {
+      try {
+        task.done(std::move(report));
+      } catch (const std::exception &e) {
+        std::cerr << "Report callback for " << task.job.params.path_id << " failed: " << e.what() << std::endl;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --in_flight;
+    }
+    task_done.notify_all();
+  }
+}
+
+} // namespace hwp
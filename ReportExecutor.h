@@ -0,0 +1,88 @@
+#pragma once
+#ifndef REPORT_EXECUTOR_H
+#define REPORT_EXECUTOR_H
+
+#include "ReportManager.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hwp {
+
+// 异步报告生成：分析线程提交任务后立即继续探索下一条路径，报告由内部 worker 生成。
+// 每个 worker 持有独立的 ReportManager，只从快照渲染，不访问 module：分析线程之后对同一 LLVMContext 的修改
+// （克隆切片、附加元数据等）会写入 context 级别的表，与 worker 同时读取 module 构成数据竞争。
+// 以 module 提交时，submit 在调用线程上提取快照（ReportManager::snapshot），返回后即可修改或释放 module。
+//
+// 已提交未完成的任务数达到 max_in_flight 时 submit 阻塞，以限制同时驻留的快照数量。
+// 回调在 worker 线程上执行，不得在回调中调用 submit 或 drain；不同任务的完成顺序不保证与提交顺序一致。
+class ReportExecutor {
+public:
+  struct Options {
+    unsigned workers = 2;
+    // 已提交未完成（排队中与生成中）的任务上限
+    unsigned max_in_flight = 16;
+    // 所有 worker 共用的源码来源，为空时使用 DiskSourceProvider::shared()
+    std::shared_ptr<SourceProvider> sources;
+  };
+
+  using Callback = std::function<void(json report)>;
+
+  explicit ReportExecutor(Options opts);
+
+  // 等待所有已提交的任务完成后退出
+  ~ReportExecutor();
+
+  ReportExecutor(const ReportExecutor &) = delete;
+  ReportExecutor &operator=(const ReportExecutor &) = delete;
+
+  // 失败的报告与 ReportManager::runJob 一致，为 {"path_id", "failed"}，future 不会携带异常。
+  // job 未给出 snapshot 时在调用线程上从 module 提取
+  std::future<json> submit(ReportManager::ReportJob job);
+
+  void submit(ReportManager::ReportJob job, Callback done);
+
+  std::future<json> submit(const llvm::Module &M, const Trace &report, bool no_trace, ReportManager::Params params);
+
+  void submit(const llvm::Module &M, const Trace &report, bool no_trace, ReportManager::Params params, Callback done);
+
+  // params 的 fields 与 trace 参数应与提取快照时相同
+  std::future<json> submit(ReportManager::ReportSnapshot snapshot, ReportManager::Params params);
+
+  void submit(ReportManager::ReportSnapshot snapshot, ReportManager::Params params, Callback done);
+
+  // 阻塞直到此前提交的所有任务完成（含回调），分析结束时调用
+  void drain();
+
+  // 已提交未完成的任务数
+  size_t inFlight();
+
+private:
+  struct Task {
+    ReportManager::ReportJob job;
+    Callback done;
+  };
+
+  Options opts;
+  bool stopping = false;
+  size_t in_flight = 0;
+
+  std::mutex mutex;
+  std::condition_variable queue_not_empty;
+  // 任务完成时通知，submit 的背压与 drain 共用
+  std::condition_variable task_done;
+  std::deque<Task> pending;
+
+  std::vector<std::thread> threads;
+
+  void workerLoop();
+};
+
+} // namespace hwp
+
+#endif
@@ -1,15 +1,60 @@
 ﻿#include "ReportManager.h"
+#include "FragmentCache.h"
 #include "VulnerableSourceAnalysis.h"
+#include <llvm/IR/InstIterator.h>
 #include <llvm/Support/Debug.h>
+#include <algorithm>
 #include <iostream>
 #include <istream>
 #include <ranges>
 #include <regex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 
 namespace hwp {
 
-set<string> ReportManager::getGlobalVariables(const llvm::Module &M, std::istream &file) {
+// 逐行遍历文本，语义与 std::getline 相同：行内容不含 '\n'，最后一行没有换行时同样返回
+static bool nextLine(std::string_view text, size_t &pos, std::string_view &line) {
+  if (pos >= text.size()) {
+    return false;
+  }
+  size_t nl = text.find('\n', pos);
+  if (nl == std::string_view::npos) {
+    nl = text.size();
+  }
+  line = text.substr(pos, nl - pos);
+  pos = nl + 1;
+  return true;
+}
+
+ReportManager::ReportManager() : ReportManager(DiskSourceProvider::shared()) {}
+
+ReportManager::ReportManager(std::shared_ptr<SourceProvider> sources) : source_provider(std::move(sources)) {
+  if (!source_provider) {
+    source_provider = DiskSourceProvider::shared();
+  }
+  source_version = source_provider->version();
+}
+
+void ReportManager::setSourceProvider(std::shared_ptr<SourceProvider> sources) {
+  source_provider = sources ? std::move(sources) : DiskSourceProvider::shared();
+  // 各文件缓存都来自旧的 provider，一并清空
+  clearSourceCaches();
+  source_version = source_provider->version();
+}
+
+void ReportManager::clearSourceCaches() {
+  nesting_structure_array.clear();
+  matching_braces_array.clear();
+  nesting_errors.clear();
+  macro_set_array.clear();
+  struct_map_array.clear();
+  source_text_array.clear();
+  file_size_cache.clear();
+}
+
+set<string> ReportManager::getGlobalVariables(const llvm::Module &M, std::string file_path) {
   set<int> lines;
   for (const llvm::GlobalVariable &G :
        M.globals() | std::views::filter([](const llvm::GlobalVariable &G) { return G.getSection() != ".modinfo"; })) {
@@ -36,35 +81,25 @@ set<string> ReportManager::getGlobalVariables(const llvm::Module &M, std::istrea
   //   llvm::dbgs() << i << ", ";
   // }
   // llvm::dbgs() << "\n";
-  auto ret = lines | std::views::transform([&file](int i) {
+  SourceText *src = get_source_text(file_path);
+  auto ret = lines | std::views::transform([&](int i) {
                /// read specific line from file
-               file.clear();
-               file.seekg(0);
-               std::string line;
-               int currentLine = 1;
-               while (std::getline(file, line)) {
-                 if (currentLine == i) {
-                   return line;
-                 }
-                 currentLine++;
-               }
-               return std::string();
+               std::optional<std::string_view> line = src ? get_line(*src, i) : std::nullopt;
+               return line ? std::string(*line) : std::string();
              });
   return {ret.begin(), ret.end()};
 }
 
 // 根据 sink点 行号列号 得到 array_name array_index
-std::pair<std::string, std::string> ReportManager::getIndex(std::ifstream &file, unsigned int lineNum,
+std::pair<std::string, std::string> ReportManager::getIndex(std::string file_path, unsigned int lineNum,
                                                             unsigned int colNum) {
   std::string firstString, secondString;
-  std::string line;
-  unsigned int currentLine = 1;
+  SourceText *src = get_source_text(file_path);
+  std::optional<std::string_view> source_line = src ? get_line(*src, lineNum) : std::nullopt;
 
-  file.clear();
-  file.seekg(0);
-
-  while (std::getline(file, line)) {
-    if (currentLine == lineNum) {
+  if (source_line) {
+    std::string_view line = *source_line;
+    {
       // 从指定的列号开始遍历
       size_t pos = colNum - 1; // 列号从 1 开始，所以需要减 1
 
@@ -83,39 +118,16 @@ std::pair<std::string, std::string> ReportManager::getIndex(std::ifstream &file,
         secondString += line[pos];
         pos++;
       }
-
-      break;
     }
-    currentLine++;
   }
 
   return {firstString, secondString};
 }
 
-bool ReportManager::checkStringInRange(std::ifstream &file, const std::string &targetString, unsigned int startLine,
+bool ReportManager::checkStringInRange(std::string file_path, const std::string &targetString, unsigned int startLine,
                                        unsigned int endLine) {
-  std::string line;
-  unsigned int currentLine = 1;
-  bool found = false;
-  file.clear(); // 清除 eof 标志
-  file.seekg(0);
-
-  while (std::getline(file, line)) {
-    if (currentLine >= startLine && currentLine <= endLine) {
-      if (line.find(targetString) != std::string::npos) {
-        found = true;
-        break;
-      }
-    }
-
-    if (currentLine > endLine) {
-      break;
-    }
-    currentLine++;
-  }
-
-  // file.close();
-  return found;
+  const TokenIndex *index = get_token_index(file_path);
+  return index && index->occursInRange(targetString, startLine, endLine);
 }
 
 std::set<unsigned> ReportManager::get_funlines_from_module(const llvm::Module &M) {
@@ -137,81 +149,85 @@ std::set<unsigned> ReportManager::get_funlines_from_module(const llvm::Module &M
   return lines;
 }
 
-std::string ReportManager::getFunction_content_brief(std::ifstream &ifs, const llvm::Module &M, unsigned int startLine,
-                                                     unsigned int endLine, std::string sourceFile) {
-  unsigned int cur_line = 1;
+std::string ReportManager::getFunction_content_brief(const std::pmr::set<unsigned> &slice_lines, unsigned int startLine,
+                                                     unsigned int endLine, unsigned int scanLine,
+                                                     std::string sourceFile) {
   std::string brief;
-  std::string line; // char[1024] -> string line
   std::string file_path = sourceFile;
-  std::set<unsigned> lines = get_funlines_from_module(M);
-  get_nesting_structure(file_path);
-  std::map<unsigned, unsigned> nesting_structure = nesting_structure_array[file_path];
-  std::vector<std::pair<unsigned, unsigned>> matching_braces = matching_braces_array[file_path];
-  /* fill in the lines with braces */
-  /* really not efficient, but easy */
-  size_t old_size;
-  do {
-    old_size = lines.size();
-    std::set<unsigned> new_lines;
+  SourceText *src = get_source_text(file_path);
+  if (!src) {
+    return brief;
+  }
+  // 只有函数范围内的切片行会影响 brief，arena 中只复制这一段
+  std::pmr::set<unsigned> lines(slice_lines.lower_bound(startLine), slice_lines.upper_bound(endLine), report_arena);
 
-    for (unsigned i : lines) {
-      // llvm::dbgs() << "newline: " << i << "\n";
-      new_lines.insert(i);
-      auto it = nesting_structure.find(i);
-      if (it != nesting_structure.end()) {
-        auto &pr = matching_braces[it->second];
-        new_lines.insert(pr.first);
-        new_lines.insert(pr.second);
+  // 函数范围可由局部扫描得到时直接使用其嵌套结构（片段缓存命中时此前未扫描过，这里补上），否则退回整文件扫描
+  const BlockExtent *block = startLine ? get_block_extent(file_path, startLine, scanLine) : nullptr;
+  if (block && block->end_line != endLine) {
+    block = nullptr;
+  }
+  // 整文件扫描也失败时不补充括号行，只输出切片行
+  static const std::map<unsigned, unsigned> no_nesting;
+  static const std::vector<std::pair<unsigned, unsigned>> no_braces;
+  const std::map<unsigned, unsigned> *nesting = &no_nesting;
+  const std::vector<std::pair<unsigned, unsigned>> *braces = &no_braces;
+  if (block) {
+    nesting = &block->nesting_structure;
+    braces = &block->matching_braces;
+  } else if (get_nesting_structure(file_path)) {
+    nesting = &nesting_structure_array.find(file_path)->second;
+    braces = &matching_braces_array.find(file_path)->second;
+  }
+  const std::map<unsigned, unsigned> &nesting_structure = *nesting;
+  const std::vector<std::pair<unsigned, unsigned>> &matching_braces = *braces;
+  /* fill in the lines with braces */
+  // 工作表方式求闭包：每行只展开一次，新加入的括号行再入表；只使用一个集合，arena 不随迭代轮数增长
+  std::pmr::vector<unsigned> worklist(lines.begin(), lines.end(), report_arena);
+  while (!worklist.empty()) {
+    unsigned i = worklist.back();
+    worklist.pop_back();
+    auto it = nesting_structure.find(i);
+    if (it != nesting_structure.end()) {
+      auto &pr = matching_braces[it->second];
+      for (unsigned brace_line : {pr.first, pr.second}) {
+        if (lines.insert(brace_line).second) {
+          worklist.push_back(brace_line);
+        }
       }
     }
+  }
 
-    lines.swap(new_lines);
-  } while (lines.size() > old_size);
-
-  ifs.clear(); // 清除 eof 标志
-  ifs.seekg(0);
-
-  while (std::getline(ifs, line)) {
-    if (lines.contains(cur_line) && cur_line >= startLine && cur_line <= endLine) {
-      // brief += to_string(cur_line) + ": ";
-      brief += line;
-      brief += "\n";
-    }
-
-    if (ifs.bad()) {
-      llvm::errs() << "An error occurred\n";
+  for (auto it = lines.lower_bound(startLine); it != lines.end() && *it <= endLine; ++it) {
+    std::optional<std::string_view> line = get_line(*src, *it);
+    if (!line) {
       break;
     }
-
-    ++cur_line;
+    // brief += to_string(cur_line) + ": ";
+    brief += *line;
+    brief += "\n";
   }
 
   return brief;
 }
 
 // 从源文件中提取宏定义
-json ReportManager::getMacroDef(const json &array, std::ifstream &file) {
-  std::string line;
+json ReportManager::getMacroDef(const json &array, std::string file_path) {
   json definitions = json::array();
+  SourceText *src = get_source_text(file_path);
+  if (!src) {
+    return definitions;
+  }
 
   for (const auto &item : array) {
-    file.clear();
-    file.seekg(0);
-    int lineNumber = 0;
-
-    while (std::getline(file, line)) {
-      ++lineNumber;
-
-      std::string targetString = item.get<std::string>();
+    std::string targetString = item.get<std::string>();
+    size_t pos = 0;
+    std::string_view line;
 
+    while (nextLine(src->text, pos, line)) {
       if (line.find(targetString) != std::string::npos) {
-        std::string str = get_source_lines(file, lineNumber, lineNumber);
-
         // 消除str 尾部的\r\n
-        size_t endPos = str.find_last_not_of("\r\n");
-        if (endPos != std::string::npos) {
-          str.erase(endPos + 1);
-        }
+        size_t endPos = line.find_last_not_of("\r\n");
+        std::string str(line.substr(0, endPos == std::string_view::npos ? 0 : endPos + 1));
 
         definitions.push_back(str);
         break;
@@ -222,105 +238,85 @@ json ReportManager::getMacroDef(const json &array, std::ifstream &file) {
   return definitions;
 }
 
-json ReportManager::findMacrosInRange(std::ifstream &file, unsigned int startLine, unsigned int endLine) {
-  static int temp = 1;
-  static std::set<std::string> macros;
-  if (temp) {
-    std::string line;
+json ReportManager::findMacrosInRange(std::string file_path, unsigned int startLine, unsigned int endLine) {
+  SourceText *src = get_source_text(file_path);
+  auto [macros_it, inserted] = macro_set_array.try_emplace(file_path);
+  std::set<std::string> &macros = macros_it->second;
+  if (inserted && src) {
     std::regex macroDefineRegex(R"(^\s*#\s*define\s+([a-zA-Z_][a-zA-Z0-9_]*)\b)");
 
-    file.clear(); // 清除 eof 标志
-    file.seekg(0);
-    while (std::getline(file, line)) {
-      std::smatch match;
-      if (std::regex_search(line, match, macroDefineRegex)) {
+    size_t pos = 0;
+    std::string_view line;
+    while (nextLine(src->text, pos, line)) {
+      std::match_results<std::string_view::const_iterator> match;
+      if (std::regex_search(line.begin(), line.end(), match, macroDefineRegex)) {
         if (match.size() > 1) {
           macros.insert(match[1].str()); // 插入宏名称
         }
       }
-      temp = 0;
     }
   }
 
   json macroArray = json::array();
-  std::string line;
-  unsigned int currentLine = 1;
-  // std::ifstream file1(filePath);
-
-  file.clear();
-  file.seekg(0);
-
-  // 遍历文件查找范围内的宏使用
-  while (std::getline(file, line)) {
-    if (currentLine >= startLine && currentLine <= endLine) {
-      for (const auto &macro : macros) {
-        if (line.find(macro) != std::string::npos) {
-          macroArray.push_back(macro);
-        }
-      }
-    }
-    if (currentLine > endLine) {
-      break;
+  const TokenIndex *index = get_token_index(file_path);
+  if (!index) {
+    return macroArray;
+  }
+
+  // 按范围内首次出现的行号排序，同一行内按宏名排序
+  std::pmr::vector<std::pair<unsigned, const std::string *>> used(report_arena);
+  for (const auto &macro : macros) {
+    if (unsigned line = index->firstInRange(macro, startLine, endLine)) {
+      used.emplace_back(line, &macro);
     }
-    currentLine++;
   }
+  std::stable_sort(used.begin(), used.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
 
-  // file1.close();
+  for (const auto &[line, macro] : used) {
+    macroArray.push_back(*macro);
+  }
   return macroArray;
 }
 
-int ReportManager::checkStructLine(std::ifstream &file, const std::string &targetString) {
-  std::string line;
-  int lineNumber = 0;
-
-  file.clear();
-  file.seekg(0);
-  while (std::getline(file, line)) {
-    lineNumber++;
-    if (line.find(targetString) != std::string::npos) {
-      return lineNumber; // 返回匹配的行号
-    }
-  }
-
-  // file.close();
-  return -1;
+int ReportManager::checkStructLine(std::string file_path, const std::string &targetString) {
+  const TokenIndex *index = get_token_index(file_path);
+  unsigned line = index ? index->firstOccurrence(targetString) : 0;
+  return line ? static_cast<int>(line) : -1; // 返回匹配的行号
 }
 
 // 检查传入结构体名称是否存在于源文件中 并返回结构体定义所在的行号
-int ReportManager::checkStruct(std::ifstream &file, string struct_name) {
+int ReportManager::checkStruct(std::string file_path, string struct_name) {
   // cout<<endl<<"checkStruct"<<endl;
-  static int temp = 1;
-  static std::map<std::string, int> structMap;
+  SourceText *src = get_source_text(file_path);
+  auto [struct_it, inserted] = struct_map_array.try_emplace(file_path);
+  std::map<std::string, int> &structMap = struct_it->second;
 
-  if (temp) {
-    file.clear();
-    file.seekg(0);
-    std::string line;
+  if (inserted && src) {
+    size_t offset = 0;
+    std::string_view line;
     int lineNumber = 0;
     std::regex structRegex(R"(struct\s+([a-zA-Z_]\w*)\s*\{)");   // struct test{类型
     std::regex structRegex2(R"(struct\s+(\w+)\s+\w+\s*=\s*\{)"); // static struct file_operations fops = {类型
 
     // static struct file_operations fops = {类型  struct test{类型
-    while (std::getline(file, line)) {
+    while (nextLine(src->text, offset, line)) {
       lineNumber++;
-      std::smatch match;
-      if (std::regex_search(line, match, structRegex)) {
+      std::match_results<std::string_view::const_iterator> match;
+      if (std::regex_search(line.begin(), line.end(), match, structRegex)) {
         structMap[match[1]] = lineNumber;
-      } else if (std::regex_search(line, match, structRegex2)) {
+      } else if (std::regex_search(line.begin(), line.end(), match, structRegex2)) {
         structMap[match[1]] = lineNumber;
       }
     }
 
-    file.clear();
-    file.seekg(0);
-
+    offset = 0;
     lineNumber = 0;
     bool structFound = false;
     std::string structName;
     int temp1 = 0;
 
     // typedef struct 类型
-    while (std::getline(file, line)) {
+    while (nextLine(src->text, offset, line)) {
       lineNumber++;
       if (line.find("typedef struct") != std::string::npos) {
         structFound = true;
@@ -329,7 +325,7 @@ int ReportManager::checkStruct(std::ifstream &file, string struct_name) {
       if (structFound) {
         size_t pos = line.find('}');
         if (pos != std::string::npos) {
-          std::istringstream iss(line.substr(pos + 1));
+          std::istringstream iss(std::string(line.substr(pos + 1)));
           iss >> structName;
           if (!structName.empty()) {
             size_t endPos = structName.find_last_not_of(";");
@@ -343,8 +339,6 @@ int ReportManager::checkStruct(std::ifstream &file, string struct_name) {
       }
     }
 
-    temp = 0;
-
     // for (const auto& entry : structMap) {
     //     std::cout <<endl<< "Key: " << entry.first << ", Value: " << entry.second << std::endl;
     // }
@@ -369,84 +363,29 @@ std::string ReportManager::resolveFilePath(const llvm::Metadata *FileMD) {
   std::cerr << "警告: 无法解析文件元数据。\n";
   return "Unknown";
 }
-std::string ReportManager::findFunctionFilePath(const llvm::Module &M, const std::string &functionName) {
-  llvm::DebugInfoFinder Finder;
-  Finder.processModule(M);
-
-  for (const auto &SP : Finder.subprograms()) {
-    if (SP->getName() == functionName) {
-      const llvm::MDNode *FileNode = SP->getFile();
-      return resolveFilePath(FileNode);
-    }
+bool ReportManager::get_nesting_structure(const std::string &source) { // 获得嵌套结构
+  if(nesting_structure_array.find(source)!=nesting_structure_array.end()){
+    return true;
   }
-
-  // std::cerr << "函数 " << functionName << " 在 IR 文件中未找到。\n";
-  return "Unknown";
-}
-
-bool ReportManager::CheckFunction(const llvm::Module &M, const llvm::Function &F) {
-  string filePath;
-
-  filePath = findFunctionFilePath(M, F.getName().str());
-
-  if (filePath != "Unknown") {
-    if (filePath.find("/include/") == std::string::npos) {
-      return true;
-    }
+  // 失败结果同样缓存，避免对同一个坏文件反复扫描
+  if (nesting_errors.contains(source)) {
+    return false;
   }
 
-  return false;
-
-  // static std::map<std::string, int> functionMap;
-  // static int temp = 1;
-
-  // if (temp) {
-  //   std::string sourceCode((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-  //   // file.close();
-
-  //   // std::regex regex(R"(\b([a-zA-Z_][a-zA-Z0-9_]*)\s*\()");
-  //   std::regex regex(R"(\b([a-zA-Z_][a-zA-Z0-9_]*)\s*\([^)]*\)\s*\{)");
-
-  //   std::sregex_iterator iter(sourceCode.begin(), sourceCode.end(), regex);
-  //   std::sregex_iterator end;
-
-  //   while (iter != end) {
-  //     std::smatch match = *iter;
-  //     std::string functionName = match.str(1);
-  //     // cout<<endl<<"functionName="<<match.str(1)<<endl;
-
-  //     functionMap[functionName] = 0;
-
-  //     ++iter;
-  //   }
-  //   temp = 0;
-  // }
-
-  // if (functionMap.contains(functionName)) {
-  //   return true;
-  // }
-  // return false;
-}
-
-void ReportManager::get_nesting_structure(const std::string &source) { // 获得嵌套结构
-  std::ifstream ifs(source);
-  if (!ifs.is_open() || ifs.bad()) {
+  SourceText *src = get_source_text(source);
+  if (!src) {
     std::cerr << "Failed opening given source file: " << source << "\n";
-    abort();
-  }
-
-  if(nesting_structure_array.find(source)!=nesting_structure_array.end()){
-    return;
+    nesting_errors[source] = "Failed opening given source file";
+    return false;
   }
 
-  char ch;
   unsigned cur_line = 1;
   unsigned idx;
   std::stack<unsigned> nesting;
   std::map<unsigned, unsigned> nesting_structure;
   std::vector<std::pair<unsigned, unsigned>> matching_braces;
 
-  while (ifs.get(ch)) {
+  for (char ch : src->text) {
     // Debug output for current character and line
     // std::cerr << "Character: " << ch << ", Line: " << cur_line << "\n";
     // std::cerr << "Stack top: " << (nesting.empty() ? "empty" : std::to_string(nesting.top())) << "\n";
@@ -467,7 +406,8 @@ void ReportManager::get_nesting_structure(const std::string &source) { // 获得
     case '}':
       if (nesting.empty()) {
         std::cerr << "Mismatched closing brace at line " << cur_line << "\n";
-        abort();
+        nesting_errors[source] = "Mismatched closing brace at line " + std::to_string(cur_line);
+        return false;
       }
       idx = nesting.top();
       assert(idx < matching_braces.size());
@@ -483,13 +423,6 @@ void ReportManager::get_nesting_structure(const std::string &source) { // 获得
   nesting_structure_array[source]=nesting_structure;
   matching_braces_array[source]=matching_braces;
 
-  if (ifs.bad()) {
-    std::cerr << "Error occurred while reading the file.\n";
-    abort();
-  }
-
-  ifs.close();
-
   // Debug output for nesting_structure
   // std::cerr << "Nesting structure:\n";
   // for (const auto &pair : nesting_structure) {
@@ -499,11 +432,17 @@ void ReportManager::get_nesting_structure(const std::string &source) { // 获得
   // for (const auto &pair : matching_braces) {
   //   std::cerr << "Start line " << pair.first << ", End line " << pair.second << "\n";
   // }
+  return true;
 }
 unsigned ReportManager::get_function_end_line(std::string file_path,unsigned start_line) {
-
-  std::map<unsigned, unsigned> nesting_structure = nesting_structure_array[file_path];
-  std::vector<std::pair<unsigned, unsigned>> matching_braces = matching_braces_array[file_path];
+  // 只读取已有的扫描结果，不为扫描失败的文件插入空条目
+  auto nesting_it = nesting_structure_array.find(file_path);
+  auto braces_it = matching_braces_array.find(file_path);
+  if (nesting_it == nesting_structure_array.end() || braces_it == matching_braces_array.end()) {
+    return 0;
+  }
+  const std::map<unsigned, unsigned> &nesting_structure = nesting_it->second;
+  const std::vector<std::pair<unsigned, unsigned>> &matching_braces = braces_it->second;
 
   unsigned end_line = 0;
   auto it = nesting_structure.find(start_line);
@@ -537,95 +476,270 @@ unsigned ReportManager::get_function_end_line(std::string file_path,unsigned sta
   return end_line;
 }
 
-std::pair<unsigned, unsigned> ReportManager::getLineNumbers(std::string file_path,const llvm::Function &F, const llvm::Module &M) {
-  unsigned startLine = 0;
-  unsigned endLine = 0;
+uint64_t ReportManager::syncSourceVersion() {
+  uint64_t version = source_provider->version();
+  if (version != source_version) {
+    clearSourceCaches();
+    source_version = version;
+  }
+  return version;
+}
 
-  llvm::DebugInfoFinder Finder;
-  Finder.processModule(M);
+ReportManager::SourceText *ReportManager::get_source_text(const std::string &file_path) {
+  auto [it, inserted] = source_text_array.try_emplace(file_path);
+  SourceText &src = it->second;
+  if (inserted) {
+    if (std::optional<SourceContents> contents = source_provider->get(file_path)) {
+      src.owner = std::move(contents->owner);
+      src.text = contents->text;
+      src.loaded = true;
+    }
+  }
+  return src.loaded ? &src : nullptr;
+}
 
-  for (const auto &FMD : Finder.subprograms()) {
-    // std::cerr << "Found subprogram: " << FMD->getName().str() << ", Line: " << FMD->getLine() << "\n";
-    if (FMD->getName() == F.getName()) {
-      startLine = FMD->getLine();
-      endLine = get_function_end_line(file_path,startLine);
+const TokenIndex *ReportManager::get_token_index(const std::string &file_path) {
+  SourceText *src = get_source_text(file_path);
+  if (!src) {
+    return nullptr;
+  }
+  if (!src->tokens) {
+    src->tokens.emplace(src->text);
+  }
+  return &*src->tokens;
+}
+
+size_t ReportManager::get_line_offset(SourceText &src, unsigned line) {
+  // 行偏移表按需向后扩展，只扫描到目前为止用到的最大行
+  while (src.line_offsets.size() < line) {
+    size_t pos = src.text.find('\n', src.line_offsets.back());
+    if (pos == std::string::npos) {
+      return std::string::npos;
+    }
+    src.line_offsets.push_back(pos + 1);
+  }
+  return line == 0 ? std::string::npos : src.line_offsets[line - 1];
+}
+
+std::optional<std::string_view> ReportManager::get_line(SourceText &src, unsigned line) {
+  size_t begin = get_line_offset(src, line);
+  if (begin == std::string::npos || begin >= src.text.size()) {
+    return std::nullopt;
+  }
+  size_t end = src.text.find('\n', begin);
+  return src.text.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+}
+
+const ReportManager::BlockExtent *ReportManager::get_block_extent(const std::string &file_path, unsigned start_line,
+                                                                  unsigned scan_line) {
+  SourceText *src = get_source_text(file_path);
+  if (!src) {
+    return nullptr;
+  }
+  auto [it, inserted] = src->blocks.try_emplace(start_line);
+  BlockExtent &block = it->second;
+  if (!inserted) {
+    return block.end_line ? &block : nullptr;
+  }
+
+  size_t pos = get_line_offset(*src, scan_line);
+  if (pos == std::string::npos) {
+    return nullptr;
+  }
+
+  // 找到 scan_line 起的第一个 '{'，遇到 ';' 说明不是定义
+  std::string_view text = src->text;
+  unsigned cur_line = scan_line;
+  for (; pos < text.size() && text[pos] != '{'; ++pos) {
+    if (text[pos] == ';' || (text[pos] == '\n' && ++cur_line - scan_line > 50)) {
+      return nullptr;
+    }
+  }
+
+  std::stack<unsigned> nesting;
+  for (; pos < text.size(); ++pos) {
+    switch (text[pos]) {
+    case '\n':
+      block.nesting_structure.emplace(cur_line, nesting.top());
+      ++cur_line;
+      break;
+    case '{':
+      nesting.push(block.matching_braces.size());
+      block.matching_braces.emplace_back(cur_line, 0);
+      break;
+    case '}':
+      block.matching_braces[nesting.top()].second = cur_line;
+      nesting.pop();
+      if (nesting.empty()) {
+        block.end_line = cur_line;
+        return &block;
+      }
+      break;
+    default:
       break;
     }
   }
 
+  // 文件结束仍未闭合
+  block.nesting_structure.clear();
+  block.matching_braces.clear();
+  return nullptr;
+}
+
+std::pair<unsigned, unsigned> ReportManager::getLineNumbers(std::string file_path,
+                                                            const ReportSnapshot::Function &function) {
+  unsigned startLine = function.start_line;
+  unsigned endLine = 0;
+
+  if (startLine) {
+    // 快速路径：从 scopeLine 开始局部匹配括号；失败或与调试信息矛盾时退回整文件嵌套结构。
+    // 单行函数与首行即有嵌套的函数，结果与整文件查找不同（见 get_block_extent），以这里为准
+    // （max_line 为函数内非内联指令的最大行号，函数结束行不会小于它）
+    unsigned scopeLine = function.scope_line ? function.scope_line : startLine;
+    const BlockExtent *block = get_block_extent(file_path, startLine, std::max(scopeLine, startLine));
+    if (block && block->end_line >= function.max_line) {
+      endLine = block->end_line;
+    } else if (get_nesting_structure(file_path)) {
+      endLine = get_function_end_line(file_path,startLine);
+    }
+  }
+
   if (startLine == 0) {
-    std::cerr << "Failed to find start line for function " << F.getName().str() << "\n";
+    std::cerr << "Failed to find start line for function " << function.name << "\n";
   }
   if (endLine == 0) {
-    std::cerr << "Failed to find end line for function " << F.getName().str() << "\n";
+    std::cerr << "Failed to find end line for function " << function.name << "\n";
   }
 
   return {startLine, endLine};
 }
 
 // 根据行号返回源文件内容
-std::string ReportManager::get_source_lines(std::ifstream &file, unsigned startLine, unsigned endLine) {
-  file.clear(); // 清除 eof 标志
-  file.seekg(0);
-
+std::string ReportManager::get_source_lines(std::string file_path, unsigned startLine, unsigned endLine) {
   std::string result;
-  std::string line;
-  unsigned currentLine = 1;
-  while (std::getline(file, line)) {
-    if (currentLine >= startLine && currentLine <= endLine) {
-      result += line + "\n";
-    }
-    if (currentLine > endLine) {
-      break;
-    }
-    ++currentLine;
+  SourceText *src = get_source_text(file_path);
+  if (!src || endLine == 0 || endLine < startLine) {
+    return result;
   }
 
+  // 定位到起止行后整体拷贝，最后一行没有换行时补上
+  size_t begin = get_line_offset(*src, std::max(startLine, 1u));
+  if (begin == std::string::npos || begin >= src->text.size()) {
+    return result;
+  }
+  size_t end = get_line_offset(*src, endLine + 1);
+  if (end == std::string::npos || end > src->text.size()) {
+    end = src->text.size();
+  }
+  result.assign(src->text.substr(begin, end - begin));
+  if (result.back() != '\n') {
+    result += '\n';
+  }
   return result;
 }
 
-nlohmann::json ReportManager::extractStructNames(std::string file_path,std::ifstream &file, const llvm::Module &M, unsigned int startLine,
-                                                 unsigned int endLine) {
-  file.clear(); // 清除 eof 标志
-  file.seekg(0);
-
-  json struct_names = json::array();
-  for (const llvm::StructType *ST : M.getIdentifiedStructTypes()) {
-    if (ST->hasName()) {
-      std::string structName = ST->getName().str();
-      std::string prefix = "struct.";
-
-      if (structName.starts_with(prefix)) {
-        structName = structName.substr(prefix.length());
-      }
-      if (checkStruct(file, structName) && checkStringInRange(file, structName, startLine, endLine)) {
-        unsigned int startLine1 = checkStruct(file, structName);
-        unsigned int endLine1 = get_function_end_line(file_path,startLine1);
-        struct_names.push_back(get_source_lines(file, startLine1, endLine1));
-      }
-
-      // std::cout << "Found struct: " << structName << "\n";
+std::optional<std::string> ReportManager::extractStruct(std::string file_path, const std::string &structName,
+                                                       unsigned int startLine, unsigned int endLine) {
+  if (checkStruct(file_path, structName) && checkStringInRange(file_path, structName, startLine, endLine)) {
+    unsigned int startLine1 = checkStruct(file_path, structName);
+    // 与函数相同按第一个 '{' 的完整代码块取结束行；"struct foo f = {n, 2};" 这类单行块只输出该行
+    const BlockExtent *block = get_block_extent(file_path, startLine1, startLine1);
+    unsigned int endLine1 = 0;
+    if (block) {
+      endLine1 = block->end_line;
+    } else if (get_nesting_structure(file_path)) {
+      endLine1 = get_function_end_line(file_path, startLine1);
     }
+    return get_source_lines(file_path, startLine1, endLine1);
   }
-  return struct_names;
+  return std::nullopt;
 }
 
 void ReportManager::removeDuplicates(json &array) {
-  std::set<json> uniqueElements;
-  json result = json::array();
+  // 只记录元素地址，保留的元素最后整体 move 到结果中，不复制 json 节点
+  auto less = [](const json *a, const json *b) { return *a < *b; };
+  std::pmr::set<const json *, decltype(less)> uniqueElements(less, report_arena);
+  std::pmr::vector<bool> keep(report_arena);
+  keep.reserve(array.size());
 
   for (const auto &element : array) {
-    if (uniqueElements.insert(element).second) {
-      result.push_back(element);
+    keep.push_back(uniqueElements.insert(&element).second);
+  }
+
+  json result = json::array();
+  for (size_t i = 0; i < keep.size(); ++i) {
+    if (keep[i]) {
+      result.push_back(std::move(array[i]));
     }
   }
 
-  array = result;
+  array = std::move(result);
 }
 
 ;
 
-json ReportManager::completeJson(const llvm::Module &M, Params &jInfo) {
+void *ReportManager::ArenaUpstream::do_allocate(size_t bytes, size_t alignment) {
+  ++stats.upstream_allocations;
+  stats.upstream_bytes += bytes;
+  return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void ReportManager::ArenaUpstream::do_deallocate(void *p, size_t bytes, size_t alignment) {
+  std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool ReportManager::ArenaUpstream::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+  return this == &other;
+}
+
+json ReportManager::encodeCompactTrace(const ReportSnapshot &snapshot, bool with_ir) {
+  json runs = json::array();
+  json *run = nullptr;
+  unsigned run_function = 0;
+  int run_file = -1;
+
+  for (const ReportSnapshot::TraceEntry &entry : snapshot.trace) {
+    if (!run || run_function != entry.function || run_file != entry.file) {
+      run_function = entry.function;
+      run_file = entry.file;
+      runs.push_back({{"function", run_function}, {"file", run_file}, {"locs", json::array()}});
+      run = &runs.back();
+      if (with_ir) {
+        (*run)["ir"] = json::array();
+      }
+    }
+
+    (*run)["locs"].push_back({entry.line, entry.column});
+    if (with_ir) {
+      (*run)["ir"].push_back(entry.ir);
+    }
+  }
+
+  json ret;
+  ret["format"] = "compact";
+  ret["functions"] = snapshot.trace_functions;
+  ret["files"] = snapshot.trace_files;
+  ret["runs"] = runs;
+  return ret;
+}
+
+json ReportManager::completeJson(const ReportSnapshot &snapshot, Params &jInfo) {
+  // 本报告内的临时容器都从 arena 分配，报告完成后一次性释放
+  alignas(std::max_align_t) std::byte arena_buffer[16 * 1024];
+  std::pmr::monotonic_buffer_resource arena(arena_buffer, sizeof(arena_buffer), &arena_upstream);
+  report_arena = &arena;
+  // 析构时记录本报告从上游申请的字节数（monotonic arena 只增不减，即本报告的峰值）
+  struct ArenaScope {
+    std::pmr::memory_resource *&current;
+    ArenaStats &stats;
+    size_t bytes_before;
+    ~ArenaScope() {
+      current = std::pmr::new_delete_resource();
+      stats.peak_report_bytes = std::max(stats.peak_report_bytes, stats.upstream_bytes - bytes_before);
+    }
+  } arena_scope{report_arena, arena_upstream.stats, arena_upstream.stats.upstream_bytes};
+  ++arena_upstream.stats.reports;
+
   json j;
 
   json function_names = json::array();
@@ -635,43 +749,134 @@ json ReportManager::completeJson(const llvm::Module &M, Params &jInfo) {
   json function_content_brief = json::array();
   json macros = json::array();
   json structs = json::array();
+  // 单个函数失败只记录在 errors 中，不影响其他函数
+  json errors = json::array();
 
-  for (const auto &F : M) {
+  const unsigned fields = jInfo.fields;
+  // 以下字段都依赖函数的行号范围与源文件，全部关闭时不打开源文件也不扫描嵌套结构
+  const bool needs_source = fields & (FieldFunctionContent | FieldFunctionContentBrief | FieldStruct | FieldMacro);
+
+  // 切片的调试行号集合与结构体名称由快照提供，在整个报告内共用
+  std::pmr::set<unsigned> slice_lines(report_arena);
+  if (fields & FieldFunctionContentBrief) {
+    slice_lines.insert(snapshot.slice_lines.begin(), snapshot.slice_lines.end());
+  }
+  const std::vector<std::string> &struct_names = snapshot.struct_names;
 
-    if (CheckFunction(M, F)) {
-      string function_name = F.getName().str();
-      string file_path = findFunctionFilePath(M, function_name);
-      get_nesting_structure(file_path);
-      auto [startLine, endLine] = getLineNumbers(file_path,F, M);
+  FragmentCache &cache = FragmentCache::instance();
+  // 本报告内的片段缓存键都使用开始时的版本
+  const uint64_t source = syncSourceVersion();
 
-      std::ifstream file(file_path);
-      if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << file_path << std::endl;
-        json j;
-        j["failed"] = "Failed to open file";
-        return j;
+  for (const ReportSnapshot::Function &function : snapshot.functions) {
+    const string &function_name = function.name;
+    const string &file_path = function.file_path;
+    if (!needs_source) {
+      function_names.push_back(function_name);
+      function_file_paths.insert(file_path);
+      continue;
+    }
+    try {
+      // 与切片无关的部分从进程级缓存中取，缺失的部分计算后写回
+      unsigned startLine = function.start_line;
+      std::shared_ptr<const FragmentCache::Fragment> cached = startLine ? cache.find(source, file_path, startLine) : nullptr;
+      std::shared_ptr<FragmentCache::Fragment> updated;
+      auto fragment = [&]() -> const FragmentCache::Fragment & { return updated ? *updated : *cached; };
+      auto update = [&]() -> FragmentCache::Fragment & {
+        if (!updated) {
+          updated = cached ? std::make_shared<FragmentCache::Fragment>(*cached)
+                           : std::make_shared<FragmentCache::Fragment>();
+        }
+        return *updated;
+      };
+
+      unsigned endLine = 0;
+      if (cached) {
+        endLine = cached->end_line;
+      } else {
+        std::tie(startLine, endLine) = getLineNumbers(file_path, function);
+        update().end_line = endLine;
+      }
+
+      // 只有缓存未命中时才需要读取源文件
+      auto requireSource = [&]() {
+        if (!get_source_text(file_path)) {
+          throw std::runtime_error("Failed to open file");
+        }
+      };
+      if (!cached) {
+        requireSource();
+      }
+      if (startLine == 0 || endLine == 0) {
+        std::string error = "Failed to find function extent";
+        if (auto it = nesting_errors.find(file_path); it != nesting_errors.end()) {
+          error += ": " + it->second;
+        }
+        errors.push_back({{"function", function_name}, {"file", file_path}, {"error", error}});
       }
 
 
       function_names.push_back(function_name);
 
-      function_file_paths.insert(findFunctionFilePath(M, function_name));
+      function_file_paths.insert(file_path);
 
-      if (startLine > 0 && endLine > 0) {
-        std::string sourceCode = get_source_lines(file, startLine, endLine);
-        function_content.push_back(sourceCode);
+      if ((fields & FieldFunctionContent) && startLine > 0 && endLine > 0) {
+        if (!fragment().content) {
+          requireSource();
+          update().content = get_source_lines(file_path, startLine, endLine);
+        }
+        function_content.push_back(*fragment().content);
       }
 
       // llvm::dbgs() << "[startLine, endLine]: " << startLine << ", " << endLine << "\n";
-      function_content_brief.push_back(getFunction_content_brief(file, M, startLine, endLine, file_path));
+      if (fields & FieldFunctionContentBrief) {
+        // brief 只取决于函数范围内的切片行号
+        uint64_t lines_hash = 14695981039346656037ull;
+        for (auto it = slice_lines.lower_bound(startLine); it != slice_lines.end() && *it <= endLine; ++it) {
+          lines_hash = (lines_hash ^ *it) * 1099511628211ull;
+        }
+        std::optional<std::string> brief = startLine ? cache.findBrief(source, file_path, startLine, lines_hash) : std::nullopt;
+        if (!brief) {
+          requireSource();
+          brief = getFunction_content_brief(slice_lines, startLine, endLine, std::max(function.scope_line, startLine),
+                                            file_path);
+          if (startLine) {
+            cache.insertBrief(source, file_path, startLine, lines_hash, *brief);
+          }
+        }
+        function_content_brief.push_back(std::move(*brief));
+      }
 
-      json temp = json::array();
-      temp = findMacrosInRange(file, startLine, endLine);
-      macros.insert(macros.end(), temp.begin(), temp.end());
+      if (fields & FieldMacro) {
+        if (!fragment().macros) {
+          requireSource();
+          json temp = findMacrosInRange(file_path, startLine, endLine);
+          update().macros = temp.get<std::vector<std::string>>();
+        }
+        for (const std::string &macro : *fragment().macros) {
+          macros.push_back(macro);
+        }
+      }
 
       //ToDo：多个文件链接在一起的情况结构体的提取是否可以正常工作？
-      temp = extractStructNames(file_path,file, M, startLine, endLine);
-      structs.insert(structs.end(), temp.begin(), temp.end());
+      if (fields & FieldStruct) {
+        for (const std::string &structName : struct_names) {
+          auto it = fragment().structs.find(structName);
+          if (it == fragment().structs.end()) {
+            requireSource();
+            it = update().structs.emplace(structName, extractStruct(file_path, structName, startLine, endLine)).first;
+          }
+          if (it->second) {
+            structs.push_back(*it->second);
+          }
+        }
+      }
+
+      if (updated && startLine) {
+        cache.insert(source, file_path, startLine, std::move(updated));
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Failed to extract function " << function_name << ": " << e.what() << std::endl;
+      errors.push_back({{"function", function_name}, {"file", file_path}, {"error", e.what()}});
     }
   }
 
@@ -681,10 +886,26 @@ json ReportManager::completeJson(const llvm::Module &M, Params &jInfo) {
 
   j["function_name"] = function_names;
   j["relative_path"] = function_file_paths;
-  j["function_content"] = function_content;
-  j["function_content_brief"] = function_content_brief;
-  j["struct"] = structs;
-  j["macro"] = macros;
+  // 未选择的字段不出现在报告中
+  if (fields & FieldFunctionContent) {
+    j["function_content"] = function_content;
+  }
+  if (fields & FieldFunctionContentBrief) {
+    j["function_content_brief"] = function_content_brief;
+  }
+  if (fields & FieldStruct) {
+    j["struct"] = structs;
+  }
+  if (fields & FieldMacro) {
+    j["macro"] = macros;
+  }
+  if (!errors.empty()) {
+    j["errors"] = errors;
+    // 没有任何函数提取成功时保留原有的 failed 字段
+    if (function_names.empty()) {
+      j["failed"] = errors[0]["error"];
+    }
+  }
   j["language"] = "c";
   j["vulnerability_type"] = jInfo.vulnerability_type;
   j["path_id"] = jInfo.path_id;
@@ -715,6 +936,155 @@ json ReportManager::completeJson(const llvm::Module &M, Params &jInfo) {
   return j;
 }
 
+ReportManager::JobCost ReportManager::estimateJobCost(const ReportJob &job) {
+  JobCost cost;
+  std::set<const llvm::DIFile *> files;
+  size_t functions = 0;
+  size_t instructions = 0;
+
+  if (job.snapshot) {
+    // 快照中没有指令数，以切片行数代替
+    std::set<std::string_view> paths;
+    for (const ReportSnapshot::Function &function : job.snapshot->functions) {
+      if (!paths.insert(function.file_path).second) {
+        continue;
+      }
+      auto [it, inserted] = file_size_cache.try_emplace(function.file_path, 0);
+      if (inserted) {
+        it->second = source_provider->size(function.file_path).value_or(0);
+      }
+      if (cost.primary_file.empty()) {
+        cost.primary_file = function.file_path;
+      }
+      cost.value += it->second / 16;
+    }
+    cost.value += job.snapshot->slice_lines.size() + 4 * job.snapshot->trace.size() +
+                  64 * job.snapshot->functions.size();
+    return cost;
+  }
+
+  for (const auto &F : *job.module) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    ++functions;
+    instructions += F.getInstructionCount();
+    if (const llvm::DISubprogram *SP = F.getSubprogram()) {
+      if (const llvm::DIFile *File = SP->getFile(); File && files.insert(File).second) {
+        std::string path = resolveFilePath(File);
+        auto [it, inserted] = file_size_cache.try_emplace(path, 0);
+        if (inserted) {
+          it->second = source_provider->size(path).value_or(0);
+        }
+        // 头文件中的函数不参与报告，主文件取第一个非头文件
+        if (cost.primary_file.empty() && path.find("/include/") == std::string::npos) {
+          cost.primary_file = path;
+        }
+        cost.value += it->second / 16;
+      }
+    }
+  }
+
+  // 经验权重：源码扫描（按文件字节）与 trace 渲染是主要开销，其次是指令与函数数量
+  cost.value += instructions + 4 * job.trace.size() + 64 * functions;
+  return cost;
+}
+
+json ReportManager::runJob(const ReportJob &job) {
+  try {
+    if (job.snapshot) {
+      return getJson(*job.snapshot, job.params);
+    }
+    return getJson(*job.module, job.trace, job.no_trace, job.params);
+  } catch (const std::exception &e) {
+    // 单个报告失败不影响整个批次，缓存保持有效
+    std::cerr << "Failed to build report " << job.params.path_id << ": " << e.what() << std::endl;
+    return {{"path_id", job.params.path_id}, {"failed", e.what()}};
+  }
+}
+
+ReportManager::BatchResult ReportManager::getJsonBatch(const std::vector<ReportJob> &jobs, unsigned workers) {
+  BatchResult result;
+  result.reports.resize(jobs.size());
+  workers = std::max(1u, std::min<unsigned>(workers, jobs.size()));
+
+  // 按主源文件分组，同一组的任务尽量交给同一个 worker 以复用其文件缓存
+  std::vector<JobCost> costs;
+  costs.reserve(jobs.size());
+  std::map<std::string, std::vector<size_t>> groups;
+  uint64_t total_cost = 0;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    costs.push_back(estimateJobCost(jobs[i]));
+    groups[costs.back().primary_file].push_back(i);
+    total_cost += costs.back().value;
+  }
+
+  // 组内按开销从大到小排列；超过平均负载的组拆开，避免单个 worker 拖尾
+  auto byCost = [&](size_t a, size_t b) { return costs[a].value > costs[b].value; };
+  uint64_t share = total_cost / workers + 1;
+  std::vector<std::pair<uint64_t, std::vector<size_t>>> chunks;
+  for (auto &[file, group] : groups) {
+    std::stable_sort(group.begin(), group.end(), byCost);
+    chunks.emplace_back(0, std::vector<size_t>());
+    for (size_t i : group) {
+      if (chunks.back().first >= share) {
+        chunks.emplace_back(0, std::vector<size_t>());
+      }
+      chunks.back().first += costs[i].value;
+      chunks.back().second.push_back(i);
+    }
+  }
+
+  // LPT：开销最大的块先分配给当前负载最小的 worker
+  std::stable_sort(chunks.begin(), chunks.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+  std::vector<uint64_t> load(workers, 0);
+  std::vector<std::vector<size_t>> queues(workers);
+  for (auto &[chunk_cost, chunk] : chunks) {
+    size_t w = std::min_element(load.begin(), load.end()) - load.begin();
+    load[w] += chunk_cost;
+    queues[w].insert(queues[w].end(), chunk.begin(), chunk.end());
+  }
+  for (auto &queue : queues) {
+    std::stable_sort(queue.begin(), queue.end(), byCost);
+  }
+
+  // worker 0 使用当前会话，其余 worker 各自持有一个 ReportManager；结果按原下标写回，输出顺序不变
+  auto runQueue = [&](ReportManager &RM, const std::vector<size_t> &queue) {
+    for (size_t i : queue) {
+      result.reports[i] = RM.runJob(jobs[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned w = 1; w < workers; ++w) {
+    threads.emplace_back([&, w] {
+      ReportManager RM(source_provider);
+      runQueue(RM, queues[w]);
+    });
+  }
+  runQueue(*this, queues[0]);
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  size_t degraded = 0;
+  json failures = json::array();
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const json &report = result.reports[i];
+    if (report.contains("failed")) {
+      failures.push_back({{"index", i}, {"path_id", jobs[i].params.path_id}, {"error", report["failed"]}});
+    } else if (report.contains("errors")) {
+      ++degraded;
+    }
+  }
+
+  result.summary["total"] = jobs.size();
+  result.summary["succeeded"] = jobs.size() - failures.size();
+  result.summary["degraded"] = degraded;
+  result.summary["failed"] = failures.size();
+  result.summary["failures"] = std::move(failures);
+  return result;
+}
+
 json ReportManager::getJson(const llvm::Module &M, const Trace &report, bool no_trace, struct Params jInfo) {
   // std::string filePath;
   // int temp = 1;
@@ -745,14 +1115,138 @@ json ReportManager::getJson(const llvm::Module &M, const Trace &report, bool no_
   // }
 
   // get_nesting_structure(filePath);
-  auto ret = completeJson(M,jInfo);
+  return getJson(M, std::vector<const llvm::Instruction *>(report.trace.begin(), report.trace.end()), no_trace, jInfo);
+}
+
+json ReportManager::getJson(const llvm::Module &M, const std::vector<const llvm::Instruction *> &trace, bool no_trace,
+                            struct Params jInfo) {
+  return getJson(snapshot(M, trace, no_trace, jInfo), jInfo);
+}
+
+ReportManager::ReportSnapshot ReportManager::snapshot(const llvm::Module &M, const Trace &report, bool no_trace,
+                                                      const Params &jInfo) {
+  return snapshot(M, std::vector<const llvm::Instruction *>(report.trace.begin(), report.trace.end()), no_trace, jInfo);
+}
+
+ReportManager::ReportSnapshot ReportManager::snapshot(const llvm::Module &M,
+                                                      const std::vector<const llvm::Instruction *> &trace,
+                                                      bool no_trace, const Params &jInfo) {
+  ReportSnapshot snap;
+  const unsigned fields = jInfo.fields;
+
+  // 没有附加子程序的函数按名称查找，只遍历一次调试信息；同名时取第一个
+  llvm::DebugInfoFinder Finder;
+  Finder.processModule(M);
+  std::map<llvm::StringRef, const llvm::DISubprogram *> subprograms;
+  for (const llvm::DISubprogram *SP : Finder.subprograms()) {
+    subprograms.try_emplace(SP->getName(), SP);
+  }
+
+  for (const llvm::Function &F : M) {
+    auto it = subprograms.find(F.getName());
+    if (it == subprograms.end()) {
+      continue;
+    }
+    // 文件与行号取自同一个子程序，函数自身的调试信息优先：
+    // 多个文件链接在一起时，同名的 static 函数不会用一个文件的行号去扫描另一个文件
+    const llvm::DISubprogram *SP = F.getSubprogram() ? F.getSubprogram() : it->second;
+    std::string file_path = SP->getFile() ? resolveFilePath(SP->getFile()) : "Unknown";
+    // 跳过头文件中的函数
+    if (file_path == "Unknown" || file_path.find("/include/") != std::string::npos) {
+      continue;
+    }
+
+    ReportSnapshot::Function &function = snap.functions.emplace_back();
+    function.name = F.getName().str();
+    function.file_path = std::move(file_path);
+    function.start_line = SP->getLine();
+    function.scope_line = SP->getScopeLine();
+    for (const auto &I : llvm::instructions(F)) {
+      if (const llvm::DILocation *Loc = I.getDebugLoc().get()) {
+        if (!Loc->getInlinedAt() && Loc->getScope()->getSubprogram() == SP) {
+          function.max_line = std::max(function.max_line, Loc->getLine());
+        }
+      }
+    }
+  }
+
+  if (fields & FieldFunctionContentBrief) {
+    std::set<unsigned> lines = get_funlines_from_module(M);
+    snap.slice_lines.assign(lines.begin(), lines.end());
+  }
+  if (fields & FieldStruct) {
+    for (const llvm::StructType *ST : M.getIdentifiedStructTypes()) {
+      if (ST->hasName()) {
+        std::string structName = ST->getName().str();
+        std::string prefix = "struct.";
+
+        if (structName.starts_with(prefix)) {
+          structName = structName.substr(prefix.length());
+        }
+        snap.struct_names.push_back(std::move(structName));
+      }
+    }
+  }
+
+  snap.no_trace = no_trace || !(fields & FieldTrace);
+  if (snap.no_trace) {
+    return snap;
+  }
+
+  // 函数与文件按首次出现的顺序编号，与紧凑 trace 中的名称表一致
+  const bool with_ir = !jInfo.compact_trace || jInfo.compact_trace_ir;
+  std::map<const llvm::Function *, unsigned> function_ids;
+  std::map<const llvm::DIFile *, int> file_ids;
+  std::map<std::string, int> file_paths;
+  auto internFile = [&](const llvm::DIFile *File) -> int {
+    if (!File) {
+      return -1;
+    }
+    auto [it, inserted] = file_ids.try_emplace(File, 0);
+    if (inserted) {
+      auto [path_it, path_inserted] = file_paths.try_emplace(resolveFilePath(File), snap.trace_files.size());
+      if (path_inserted) {
+        snap.trace_files.push_back(path_it->first);
+      }
+      it->second = path_it->second;
+    }
+    return it->second;
+  };
+
+  snap.trace.reserve(trace.size());
+  for (const llvm::Instruction *I : trace) {
+    const llvm::Function *F = I->getFunction();
+    auto [fn_it, fn_inserted] = function_ids.try_emplace(F, snap.trace_functions.size());
+    if (fn_inserted) {
+      snap.trace_functions.push_back(F->getName().str());
+    }
+
+    ReportSnapshot::TraceEntry &entry = snap.trace.emplace_back();
+    entry.function = fn_it->second;
+    if (const llvm::DILocation *Loc = I->getDebugLoc().get()) {
+      entry.line = Loc->getLine();
+      entry.column = Loc->getColumn();
+      entry.file = internFile(Loc->getFile());
+    } else if (const llvm::DISubprogram *SP = F->getSubprogram()) {
+      entry.file = internFile(SP->getFile());
+    }
+    if (with_ir) {
+      llvm::raw_string_ostream(entry.ir) << *I;
+    }
+  }
+  return snap;
+}
+
+json ReportManager::getJson(const ReportSnapshot &snapshot, struct Params jInfo) {
+  auto ret = completeJson(snapshot, jInfo);
 
-  if (!no_trace) {
+  bool no_trace = snapshot.no_trace || !(jInfo.fields & FieldTrace);
+  if (!no_trace && jInfo.compact_trace) {
+    ret["trace"] = encodeCompactTrace(snapshot, jInfo.compact_trace_ir);
+  } else if (!no_trace) {
     ret["trace"] = nlohmann::json::array();
-    for (const auto &v : report.trace) {
-      std::string str;
-      llvm::raw_string_ostream(str) << *v;
-      ret["trace"].push_back(str);
+    for (const auto &entry : snapshot.trace) {
+      ret["trace"].push_back(entry.ir);
     }
   }
   ret["source_info"]["source_type"] = jInfo.source_info_type;
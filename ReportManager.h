@@ -2,6 +2,8 @@
 #ifndef REPORT_MANAGER_H
 #define REPORT_MANAGER_H
 
+#include "SourceProvider.h"
+#include "TokenIndex.h"
 #include "VulnerableSourceAnalysis.h"
 #include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/DebugInfoMetadata.h>
@@ -15,7 +17,11 @@
 #include <cassert>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -26,6 +32,16 @@ namespace hwp {
 
 class ReportManager {
 public:
+  // 报告字段掩码，关闭的字段对应的提取步骤整体跳过
+  enum ReportField : unsigned {
+    FieldFunctionContent = 1u << 0,
+    FieldFunctionContentBrief = 1u << 1,
+    FieldStruct = 1u << 2,
+    FieldMacro = 1u << 3,
+    FieldTrace = 1u << 4,
+    FieldAll = FieldFunctionContent | FieldFunctionContentBrief | FieldStruct | FieldMacro | FieldTrace,
+  };
+
   struct Params {
     std::string path_id;
     std::string produce_line;
@@ -51,13 +67,128 @@ public:
 
     //
     std::string vulnerability_type;
+
+    // trace 输出格式：compact_trace 为 true 时按函数与调试位置分组输出，
+    // 仅当 compact_trace_ir 为 true 时附带每条指令的 IR 文本
+    bool compact_trace = false;
+    bool compact_trace_ir = false;
+
+    // ReportField 的组合，function_name、relative_path 及 sink/source 信息总是输出
+    unsigned fields = FieldAll;
+  };
+
+  // 报告快照：渲染报告所需的全部信息都从 module 与 trace 中提取出来，提取后即可释放 module。
+  // 快照按提取时的 Params 裁剪（未选择的字段不提取，trace 只保留所需格式的内容），渲染时应使用相同的 fields 与 trace 参数
+  struct ReportSnapshot {
+    // 参与报告的函数（不含头文件中的函数），按 module 中的顺序
+    struct Function {
+      std::string name;
+      std::string file_path;
+      // DISubprogram 的行号与 scopeLine，没有调试信息时为 0
+      unsigned start_line = 0;
+      unsigned scope_line = 0;
+      // 函数内（非内联进来的）指令的最大行号
+      unsigned max_line = 0;
+    };
+
+    // trace 中的一条指令，function/file 为下方名称表中的序号，file 为 -1 表示没有调试信息
+    struct TraceEntry {
+      unsigned function = 0;
+      int file = -1;
+      unsigned line = 0;
+      unsigned column = 0;
+      // 指令的 IR 文本，输出格式不需要时为空
+      std::string ir;
+    };
+
+    std::vector<Function> functions;
+    // 切片中所有指令的调试行号（升序、去重）
+    std::vector<unsigned> slice_lines;
+    // module 中的结构体类型名称（去掉 "struct." 前缀）
+    std::vector<std::string> struct_names;
+
+    bool no_trace = false;
+    std::vector<TraceEntry> trace;
+    std::vector<std::string> trace_functions;
+    std::vector<std::string> trace_files;
+  };
+
+  // 批处理中的一个报告任务，module 需在 getJsonBatch 返回前保持有效；
+  // 多个 worker 可能同时读取同一个 LLVMContext 中的 module，期间调用方不得修改它们。
+  // 给出 snapshot 时只从快照渲染，module、trace 与 no_trace 不再使用
+  struct ReportJob {
+    const llvm::Module *module;
+    std::vector<const llvm::Instruction *> trace;
+    bool no_trace = false;
+    Params params;
+    std::shared_ptr<const ReportSnapshot> snapshot;
+  };
+
+  // reports 与 jobs 一一对应；失败的报告为 {"path_id", "failed"}，部分函数失败的报告带有 "errors"
+  // summary: {"total", "succeeded", "degraded", "failed", "failures": [{"index", "path_id", "error"}]}
+  struct BatchResult {
+    std::vector<json> reports;
+    json summary;
+  };
+
+  // 报告构建 arena 的统计：upstream_allocations 为 arena 向堆申请内存块的次数
+  struct ArenaStats {
+    size_t reports = 0;
+    size_t upstream_allocations = 0;
+    size_t upstream_bytes = 0;
+    size_t peak_report_bytes = 0; // 单个报告的最大上游字节数
   };
 
 private:
+  // arena 的上游内存资源，转发到 new/delete 并记录申请次数。
+  // 统计保存在自身内部而不是引用其他成员，ReportManager 复制或移动后仍然有效
+  class ArenaUpstream : public std::pmr::memory_resource {
+  public:
+    ArenaStats stats;
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+  };
+
+  ArenaUpstream arena_upstream;
+  // 当前报告的 arena，仅在 completeJson 执行期间指向栈上的 monotonic_buffer_resource
+  std::pmr::memory_resource *report_arena = std::pmr::new_delete_resource();
+
   // std::map<unsigned, unsigned> nesting_structure;
   // std::vector<std::pair<unsigned, unsigned>> matching_braces;
   std::map<string, std::map<unsigned, unsigned>> nesting_structure_array;
   std::map<string, std::vector<std::pair<unsigned, unsigned>>> matching_braces_array;
+  std::map<string, std::string> nesting_errors;
+
+  // 局部括号扫描结果：从起始行后第一个 '{' 到与之匹配的 '}'，嵌套结构只覆盖该范围
+  struct BlockExtent {
+    unsigned end_line = 0;
+    std::map<unsigned, unsigned> nesting_structure;
+    std::vector<std::pair<unsigned, unsigned>> matching_braces;
+  };
+
+  // 所有源文件读取都经由该接口，默认读取磁盘文件
+  std::shared_ptr<SourceProvider> source_provider;
+  // 按文件缓存的结果所对应的 provider 版本
+  uint64_t source_version = 0;
+
+  // 按文件缓存的源码文本（指向 provider 持有的内容），行偏移表按需扩展，局部扫描结果按起始行缓存（失败的扫描 end_line 为 0）
+  struct SourceText {
+    bool loaded = false;
+    // text 指向 owner 持有的内存，provider 替换或清空内容后仍然有效
+    std::shared_ptr<const void> owner;
+    std::string_view text;
+    std::vector<size_t> line_offsets{0};
+    std::map<unsigned, BlockExtent> blocks;
+    // 标识符倒排索引，首次查询时建立
+    std::optional<TokenIndex> tokens;
+  };
+  std::map<string, SourceText> source_text_array;
+  // 按文件缓存宏名称与结构体定义行号，常驻会话中多个源文件共用同一个 ReportManager
+  std::map<string, std::set<std::string>> macro_set_array;
+  std::map<string, std::map<std::string, int>> struct_map_array;
 
   /*
   void findStructDefinitions(const llvm::Module &M) {
@@ -79,67 +210,128 @@ private:
   }
   */
 
-  set<std::string> getGlobalVariables(const llvm::Module &M, std::istream &file);
+  set<std::string> getGlobalVariables(const llvm::Module &M, std::string file_path);
 
   // 根据 sink点 行号列号 得到 array_name array_index
-  std::pair<std::string, std::string> getIndex(std::ifstream &file, unsigned int lineNum, unsigned int colNum);
+  std::pair<std::string, std::string> getIndex(std::string file_path, unsigned int lineNum, unsigned int colNum);
 
-  // 函数：检查指定的字符串是否出现在指定的行号范围内
-  bool checkStringInRange(std::ifstream &file, const std::string &targetString, unsigned int startLine,
+  // 函数：检查指定的标识符是否出现在指定的行号范围内
+  bool checkStringInRange(std::string file_path, const std::string &targetString, unsigned int startLine,
                           unsigned int endLine);
 
   // 通过dg所切出来的IR 文件得到代码行号
-  std::set<unsigned> get_funlines_from_module(const llvm::Module &M);
+  static std::set<unsigned> get_funlines_from_module(const llvm::Module &M);
 
-  std::string getFunction_content_brief(std::ifstream &ifs, const llvm::Module &M, unsigned int startLine,
-                                        unsigned int endLine, std::string sourceFile);
+  // slice_lines 为切片中所有指令的调试行号，scanLine 为局部括号扫描的起始行（见 get_block_extent）
+  std::string getFunction_content_brief(const std::pmr::set<unsigned> &slice_lines, unsigned int startLine,
+                                        unsigned int endLine, unsigned int scanLine, std::string sourceFile);
 
   // 从源文件中提取宏定义
-  json getMacroDef(const json &array, std::ifstream &file);
+  json getMacroDef(const json &array, std::string file_path);
 
   // 函数：查找指定行号范围内的宏使用
-  json findMacrosInRange(std::ifstream &file, unsigned int startLine, unsigned int endLine);
+  json findMacrosInRange(std::string file_path, unsigned int startLine, unsigned int endLine);
 
-  int checkStructLine(std::ifstream &file, const std::string &targetString);
+  // 标识符在文件中首次出现的行号，没有时返回 -1
+  int checkStructLine(std::string file_path, const std::string &targetString);
 
   // 检查传入结构体名称是否存在于源文件中 并返回结构体定义所在的行号
-  int checkStruct(std::ifstream &file, string struct_name);
+  int checkStruct(std::string file_path, string struct_name);
+
+  static std::string resolveFilePath(const llvm::Metadata *FileMD);
 
-  std::string resolveFilePath(const llvm::Metadata *FileMD);
+  // 得到源代码嵌套结构，用以确定函数对应的结束行
+  // 无法打开文件或括号不匹配时返回 false，原因记录在 nesting_errors 中
+  bool get_nesting_structure(const std::string &source);
 
-  // 从 IR 文件调试信息中查找函数文件位置
-  std::string findFunctionFilePath(const llvm::Module &M, const std::string &functionName);
+  SourceText *get_source_text(const std::string &file_path);
 
-  // 检查传入函数名称是否存在于源代码中
-  bool CheckFunction(const llvm::Module &M, const llvm::Function &F);
+  // 丢弃所有按文件缓存的结果
+  void clearSourceCaches();
 
-  // 得到源代码嵌套结构，用以确定函数对应的结束行
-  void get_nesting_structure(const std::string &source);
+  // provider 版本变化（更换 provider、内容更新或 invalidate）时丢弃按文件缓存的结果，返回当前版本
+  uint64_t syncSourceVersion();
+
+  // 范围内标识符查询（结构体、宏的使用）都经由该索引，文件无法读取时返回 nullptr
+  const TokenIndex *get_token_index(const std::string &file_path);
+
+  // 第 line 行（从 1 开始）在文本中的起始偏移，超出文件时返回 npos
+  size_t get_line_offset(SourceText &src, unsigned line);
+
+  // 第 line 行的内容（不含换行），超出文件时返回 nullopt
+  std::optional<std::string_view> get_line(SourceText &src, unsigned line);
 
+  // 从 scan_line 开始局部匹配括号得到代码块范围，结果以 start_line 为键缓存，失败返回 nullptr。
+  // 与 get_function_end_line 的结果不同：后者取起始行末尾仍未闭合的最内层括号，
+  // 起始行内有成对括号（"int f(void) { return 0; }"、"{ if (x) {"）时会落到其他代码块上；
+  // 这里总是取第一个 '{' 所在的完整代码块
+  const BlockExtent *get_block_extent(const std::string &file_path, unsigned start_line, unsigned scan_line);
+
+  // 需先调用 get_nesting_structure 且成功，否则返回 0
   // unsigned get_function_end_line(unsigned start_line);
   unsigned get_function_end_line(std::string file_path,unsigned start_line);
 
+
   // std::pair<unsigned, unsigned> getLineNumbers(const llvm::Function &F, const llvm::Module &M);
-  std::pair<unsigned, unsigned> getLineNumbers(std::string file_path,const llvm::Function &F, const llvm::Module &M);
+  std::pair<unsigned, unsigned> getLineNumbers(std::string file_path, const ReportSnapshot::Function &function);
 
-  std::string get_source_lines(std::ifstream &file, unsigned startLine, unsigned endLine);
+  std::string get_source_lines(std::string file_path, unsigned startLine, unsigned endLine);
 
-  // 从IR 文件调试信息中提取结构体名称 检查是否存在于源代码中 提取结构体内容至数组
-  // nlohmann::json extractStructNames(std::ifstream &file, const llvm::Module &M, unsigned int startLine,
-  //                                   unsigned int endLine);
-  nlohmann::json extractStructNames(std::string file_path,std::ifstream &file, const llvm::Module &M, unsigned int startLine,
-                                  unsigned int endLine);
+  // 检查结构体是否在函数范围内被使用，是则返回结构体定义内容
+  std::optional<std::string> extractStruct(std::string file_path, const std::string &structName, unsigned int startLine,
+                                           unsigned int endLine);
 
   // Json 数组去重函数
   void removeDuplicates(json &array);
 
 
+  // 紧凑 trace：连续的指令按 (函数, 文件) 分组，位置取自 DILocation，函数名与文件路径去重后存放在表中
+  json encodeCompactTrace(const ReportSnapshot &snapshot, bool with_ir);
+
+  // 由模块统计信息（函数数、指令数、引用的源文件大小、trace 长度）估计报告开销
+  struct JobCost {
+    uint64_t value = 0;
+    std::string primary_file;
+  };
+  std::map<std::string, uint64_t> file_size_cache;
+  JobCost estimateJobCost(const ReportJob &job);
+
   // 填充 Json文件
-  json completeJson(const llvm::Module &M, Params &jInfo);
+  json completeJson(const ReportSnapshot &snapshot, Params &jInfo);
 
   // 接口函数
 public:
+  ReportManager();
+
+  // 源码从给定的 provider 读取（内存、归档等），为空时使用 DiskSourceProvider::shared()
+  explicit ReportManager(std::shared_ptr<SourceProvider> sources);
+
+  // 更换 provider 并清空按文件缓存的结果
+  void setSourceProvider(std::shared_ptr<SourceProvider> sources);
+
   json getJson(const llvm::Module &M, const Trace &report, bool no_trace, struct Params jInfo);
+
+  // trace 以指令列表给出，供不持有 Trace 对象的调用方（如 ReportDaemon）使用
+  json getJson(const llvm::Module &M, const std::vector<const llvm::Instruction *> &trace, bool no_trace,
+               struct Params jInfo);
+
+  // 提取报告快照，之后可释放 module，在其他时间或线程上用 getJson(snapshot, ...) 渲染。
+  // 只读取 module，不使用任何 ReportManager 的状态，可在持有 module 的线程上直接调用
+  static ReportSnapshot snapshot(const llvm::Module &M, const std::vector<const llvm::Instruction *> &trace,
+                                 bool no_trace, const Params &jInfo);
+
+  static ReportSnapshot snapshot(const llvm::Module &M, const Trace &report, bool no_trace, const Params &jInfo);
+
+  json getJson(const ReportSnapshot &snapshot, struct Params jInfo);
+
+  // 单个报告出错不会中断批次。workers > 1 时按开销估计调度：大任务先执行，
+  // 主源文件相同的任务分给同一个 worker；reports 的顺序始终与 jobs 一致
+  BatchResult getJsonBatch(const std::vector<ReportJob> &jobs, unsigned workers = 1);
+
+  // 生成单个报告，异常转换为 {"path_id", "failed"}
+  json runJob(const ReportJob &job);
+
+  const ArenaStats &arenaStats() const { return arena_upstream.stats; }
 };
 
 } // namespace hwp
@@ -0,0 +1,208 @@
+#include "SourceProvider.h"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <iostream>
+
+namespace hwp {
+
+// 所有 provider 共用的版本计数，保证不同 provider 的版本互不相同
+static std::atomic<uint64_t> next_version{1};
+
+SourceProvider::SourceProvider() : current_version(next_version.fetch_add(1)) {}
+
+void SourceProvider::bumpVersion() { current_version.store(next_version.fetch_add(1), std::memory_order_release); }
+
+void SourceProvider::invalidate() { bumpVersion(); }
+
+std::optional<uint64_t> SourceProvider::size(const std::string &path) {
+  auto contents = get(path);
+  if (!contents) {
+    return std::nullopt;
+  }
+  return contents->text.size();
+}
+
+std::shared_ptr<DiskSourceProvider> DiskSourceProvider::shared() {
+  static const std::shared_ptr<DiskSourceProvider> provider = std::make_shared<DiskSourceProvider>();
+  return provider;
+}
+
+std::optional<SourceContents> DiskSourceProvider::get(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto [it, inserted] = buffers.try_emplace(path);
+  if (inserted) {
+    // 不要求结尾为 '\0'，以便 MemoryBuffer 对大文件直接使用 mmap
+    auto bufferOrErr = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (bufferOrErr) {
+      it->second = std::move(*bufferOrErr);
+    }
+  }
+  if (!it->second) {
+    return std::nullopt;
+  }
+  return SourceContents{std::string_view(it->second->getBufferStart(), it->second->getBufferSize()), it->second};
+}
+
+void DiskSourceProvider::invalidate() {
+  std::lock_guard<std::mutex> lock(mutex);
+  buffers.clear();
+  bumpVersion();
+}
+
+std::optional<uint64_t> DiskSourceProvider::size(const std::string &path) {
+  uint64_t result;
+  if (llvm::sys::fs::file_size(path, result)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+void MemorySourceProvider::add(const std::string &path, std::string contents) {
+  auto text = std::make_shared<const std::string>(std::move(contents));
+  std::lock_guard<std::mutex> lock(mutex);
+  files[path] = std::move(text);
+  // 新增路径同样更新版本：读取方可能已把该路径记为不存在
+  bumpVersion();
+}
+
+std::optional<SourceContents> MemorySourceProvider::get(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = files.find(path);
+  if (it == files.end()) {
+    return std::nullopt;
+  }
+  return SourceContents{*it->second, it->second};
+}
+
+// tar 头部中的数字字段为八进制文本
+static uint64_t parseOctal(std::string_view field) {
+  uint64_t value = 0;
+  for (char c : field) {
+    if (c >= '0' && c <= '7') {
+      value = value * 8 + (c - '0');
+    } else if (c != ' ' && value != 0) {
+      break;
+    }
+  }
+  return value;
+}
+
+static std::string_view cstrField(const char *p, size_t n) {
+  size_t len = 0;
+  while (len < n && p[len] != '\0') {
+    ++len;
+  }
+  return {p, len};
+}
+
+// 去掉 "."、".." 与多余的 '/'，包内路径与查询路径都经过它
+static std::string normalizePath(std::string_view path) {
+  llvm::SmallString<256> result(path);
+  llvm::sys::path::remove_dots(result, /*remove_dot_dot=*/true);
+  return std::string(result.str());
+}
+
+ArchiveSourceProvider::ArchiveSourceProvider(const std::string &tar_path, std::string root)
+    : root(normalizePath(root)) {
+  while (!this->root.empty() && this->root.back() == '/') {
+    this->root.pop_back();
+  }
+
+  auto bufferOrErr = llvm::MemoryBuffer::getFile(tar_path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (!bufferOrErr) {
+    std::cerr << "Failed to open source archive " << tar_path << ": " << bufferOrErr.getError().message() << "\n";
+    return;
+  }
+  buffer = std::move(*bufferOrErr);
+
+  const char *data = buffer->getBufferStart();
+  size_t size = buffer->getBufferSize();
+  size_t pos = 0;
+  // GNU 'L' 与 pax 'x' 头部为下一个条目提供长路径
+  std::string long_name;
+
+  while (pos + 512 <= size) {
+    const char *header = data + pos;
+    if (header[0] == '\0') {
+      break; // 结束块
+    }
+
+    uint64_t file_size = parseOctal(std::string_view(header + 124, 12));
+    char type = header[156];
+    size_t content = pos + 512;
+    if (content + file_size > size) {
+      std::cerr << "Truncated source archive " << tar_path << "\n";
+      break;
+    }
+    std::string_view body(data + content, file_size);
+
+    if (type == 'L') {
+      long_name = std::string(cstrField(body.data(), body.size()));
+    } else if (type == 'x') {
+      // pax 记录格式："<len> path=<value>\n"
+      size_t rec = 0;
+      while (rec < body.size()) {
+        size_t space = body.find(' ', rec);
+        if (space == std::string_view::npos) {
+          break;
+        }
+        size_t len = 0;
+        for (char c : body.substr(rec, space - rec)) {
+          len = len * 10 + (c >= '0' && c <= '9' ? c - '0' : 0);
+        }
+        if (len <= space - rec + 1 || rec + len > body.size()) {
+          break;
+        }
+        std::string_view record = body.substr(space + 1, rec + len - space - 2);
+        if (record.starts_with("path=")) {
+          long_name = std::string(record.substr(5));
+        }
+        rec += len;
+      }
+    } else if (type == '0' || type == '\0') {
+      std::string name = long_name;
+      if (name.empty()) {
+        // 只有 POSIX ustar 格式才有 prefix 字段，GNU 格式的同一位置存放其他信息
+        std::string_view prefix =
+            std::string_view(header + 257, 6) == std::string_view("ustar\0", 6) ? cstrField(header + 345, 155) : "";
+        std::string_view base = cstrField(header, 100);
+        name = std::string(prefix);
+        if (!name.empty()) {
+          name += '/';
+        }
+        name += base;
+      }
+      entries[normalizePath(name)] = body;
+      long_name.clear();
+    } else {
+      long_name.clear();
+    }
+
+    pos = content + (file_size + 511) / 512 * 512;
+  }
+}
+
+std::optional<SourceContents> ArchiveSourceProvider::get(const std::string &path) {
+  // 调试信息中的路径可能带有 "./"、".." 或重复的 '/'，与包内路径按同样方式规范化后再匹配
+  std::string normalized = normalizePath(path);
+  std::string_view name = normalized;
+  if (!root.empty()) {
+    if (!name.starts_with(root) || name.size() <= root.size() || name[root.size()] != '/') {
+      return std::nullopt;
+    }
+    name.remove_prefix(root.size() + 1);
+  } else {
+    // 与 tar 打包时的处理一致，绝对路径去掉开头的 '/'
+    while (name.starts_with('/')) {
+      name.remove_prefix(1);
+    }
+  }
+  auto it = entries.find(name);
+  if (it == entries.end()) {
+    return std::nullopt;
+  }
+  return SourceContents{it->second, buffer};
+}
+
+} // namespace hwp
@@ -0,0 +1,103 @@
+#pragma once
+#ifndef SOURCE_PROVIDER_H
+#define SOURCE_PROVIDER_H
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace hwp {
+
+// 文件内容：text 指向的内存由 owner 持有，内容被替换或清空后，持有 owner 的一方仍可继续使用
+struct SourceContents {
+  std::string_view text;
+  std::shared_ptr<const void> owner;
+};
+
+// 源码读取接口，ReportManager 对源文件的所有访问都经由它完成。实现需保证多线程并发调用安全。
+class SourceProvider {
+public:
+  SourceProvider();
+  virtual ~SourceProvider() = default;
+
+  SourceProvider(const SourceProvider &) = delete;
+  SourceProvider &operator=(const SourceProvider &) = delete;
+
+  // 按调试信息中解析出的路径取文件内容，不存在时返回 nullopt
+  virtual std::optional<SourceContents> get(const std::string &path) = 0;
+
+  // 文件大小，仅用于开销估计；默认实现读取内容
+  virtual std::optional<uint64_t> size(const std::string &path);
+
+  // 丢弃已读取的内容，之后的 get 重新读取（源码树被更新时调用）
+  virtual void invalidate();
+
+  // 内容版本，在进程内所有 provider 之间唯一，内容被替换或清空时更新。
+  // FragmentCache 以它作为键的一部分；ReportManager 发现版本变化时丢弃按文件缓存的结果
+  uint64_t version() const { return current_version.load(std::memory_order_acquire); }
+
+protected:
+  void bumpVersion();
+
+private:
+  std::atomic<uint64_t> current_version;
+};
+
+// 直接读取磁盘文件，较大的文件以 mmap 方式映射，每个文件只打开一次
+class DiskSourceProvider : public SourceProvider {
+public:
+  // 进程内共用的实例：默认构造的 ReportManager / ReportExecutor / ReportDaemon 都使用它，
+  // 共享同一份映射和同一个版本，从而共享 FragmentCache 中的条目
+  static std::shared_ptr<DiskSourceProvider> shared();
+
+  std::optional<SourceContents> get(const std::string &path) override;
+  std::optional<uint64_t> size(const std::string &path) override;
+  void invalidate() override;
+
+private:
+  std::mutex mutex;
+  // 打开失败的文件同样记录（空指针），避免重复尝试
+  std::map<std::string, std::shared_ptr<llvm::MemoryBuffer>> buffers;
+};
+
+// 由调用方提供的内存中的源码
+class MemorySourceProvider : public SourceProvider {
+public:
+  // 每次添加都更新版本（包括新路径，使之前缓存的“不存在”失效），先前读取到的内容仍由读取方持有
+  void add(const std::string &path, std::string contents);
+  std::optional<SourceContents> get(const std::string &path) override;
+
+private:
+  std::mutex mutex;
+  std::map<std::string, std::shared_ptr<const std::string>> files;
+};
+
+// 只读映射一个未压缩的 tar 包（ustar/GNU/pax 格式），不解包直接按路径取文件。
+// root 为打包时的源码根目录：查询路径 root + "/" + name 对应包内的 name；
+// root 为空时按绝对路径打包（tar -C / ...），查询路径去掉开头的 '/' 后直接匹配。
+// 包内路径、root 与查询路径都先去掉 "."、".." 与多余的 '/' 再比较。
+class ArchiveSourceProvider : public SourceProvider {
+public:
+  ArchiveSourceProvider(const std::string &tar_path, std::string root);
+
+  bool is_open() const { return buffer != nullptr; }
+  size_t fileCount() const { return entries.size(); }
+
+  std::optional<SourceContents> get(const std::string &path) override;
+
+private:
+  std::string root;
+  std::shared_ptr<llvm::MemoryBuffer> buffer;
+  // 包内路径 -> 文件内容，构造后只读
+  std::map<std::string, std::string_view, std::less<>> entries;
+};
+
+} // namespace hwp
+
+#endif
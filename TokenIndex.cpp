@@ -0,0 +1,70 @@
+#include "TokenIndex.h"
+#include <algorithm>
+
+namespace hwp {
+
+static bool isIdentStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+
+static bool isIdentChar(char c) { return isIdentStart(c) || (c >= '0' && c <= '9'); }
+
+TokenIndex::TokenIndex(std::string_view text) {
+  unsigned cur_line = 1;
+  size_t pos = 0;
+
+  while (pos < text.size()) {
+    char c = text[pos];
+    if (c == '\n') {
+      ++cur_line;
+      ++pos;
+    } else if (isIdentStart(c)) {
+      size_t begin = pos;
+      while (pos < text.size() && isIdentChar(text[pos])) {
+        ++pos;
+      }
+      std::string_view id = text.substr(begin, pos - begin);
+      auto it = lines.find(id);
+      if (it == lines.end()) {
+        it = lines.emplace(std::string(id), std::vector<unsigned>()).first;
+      }
+      // 按行号顺序扫描，只需与最后一项比较即可去重
+      if (it->second.empty() || it->second.back() != cur_line) {
+        it->second.push_back(cur_line);
+      }
+    } else if (c >= '0' && c <= '9') {
+      // 跳过数字字面量，避免 0x1f 中的 x1f 被当作标识符
+      while (pos < text.size() && isIdentChar(text[pos])) {
+        ++pos;
+      }
+    } else {
+      ++pos;
+    }
+  }
+}
+
+const std::vector<unsigned> *TokenIndex::find(std::string_view id) const {
+  auto it = lines.find(id);
+  return it == lines.end() ? nullptr : &it->second;
+}
+
+unsigned TokenIndex::firstInRange(std::string_view id, unsigned startLine, unsigned endLine) const {
+  const std::vector<unsigned> *occurrences = find(id);
+  if (!occurrences) {
+    return 0;
+  }
+  auto it = std::lower_bound(occurrences->begin(), occurrences->end(), startLine);
+  if (it == occurrences->end() || *it > endLine) {
+    return 0;
+  }
+  return *it;
+}
+
+bool TokenIndex::occursInRange(std::string_view id, unsigned startLine, unsigned endLine) const {
+  return firstInRange(id, startLine, endLine) != 0;
+}
+
+unsigned TokenIndex::firstOccurrence(std::string_view id) const {
+  const std::vector<unsigned> *occurrences = find(id);
+  return occurrences ? occurrences->front() : 0;
+}
+
+} // namespace hwp
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef TOKEN_INDEX_H
+#define TOKEN_INDEX_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace hwp {
+
+// 源文件的标识符倒排索引：标识符 -> 出现的行号（升序、去重），一次词法扫描建立。
+// 按完整标识符匹配，"BUF" 不会命中 "BUF_SIZE"。
+class TokenIndex {
+public:
+  explicit TokenIndex(std::string_view text);
+
+  // 标识符是否出现在 [startLine, endLine] 内
+  bool occursInRange(std::string_view id, unsigned startLine, unsigned endLine) const;
+
+  // [startLine, endLine] 内第一次出现的行号，没有时返回 0
+  unsigned firstInRange(std::string_view id, unsigned startLine, unsigned endLine) const;
+
+  // 文件中第一次出现的行号，没有时返回 0
+  unsigned firstOccurrence(std::string_view id) const;
+
+private:
+  std::map<std::string, std::vector<unsigned>, std::less<>> lines;
+
+  const std::vector<unsigned> *find(std::string_view id) const;
+};
+
+} // namespace hwp
+
+#endif